@@ -0,0 +1,228 @@
+#pragma once
+
+#if __cplusplus < 202002L
+#error "AsyncDetection.h requires C++20 (coroutines)"
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+
+namespace mdetect {
+
+/// \brief Awaitable running motion detection on a user-supplied executor.
+///
+/// \tparam DETECTOR  Motion detector type (e.g. JpegMotionDetector).
+/// \tparam EXECUTOR  Executor type providing
+///                   `void execute(std::coroutine_handle<> handle) noexcept`
+///                   which resumes `handle` on one of its threads.
+///
+/// Awaiting it suspends the awaiting coroutine and hands it over to the
+/// executor. Once resumed there, the frame is decoded and detection is run
+/// on the executor's thread and the awaiting coroutine continues with the
+/// result of the detector's `detect()`. The frame buffer is passed on as is
+/// (no copy) and must stay valid until then. Nothing is allocated: the
+/// awaitable lives in the coroutine frame and only the coroutine handle is
+/// handed over to the executor.
+///
+/// The awaiting coroutine is not resumed back on the thread it was suspended
+/// on: everything following the `co_await` runs on the executor's thread,
+/// until the coroutine suspends again. Code after it touching state shared
+/// with the caller's thread (e.g. a UI) must synchronize, or hand the results
+/// over (e.g. through a SnapshotPublisher) or await an awaitable resuming on
+/// the caller's own executor.
+///
+/// Created by detect_async(). The detector (along with its decoder) must not
+/// be used by anything else until detection completes.
+template<typename DETECTOR, typename EXECUTOR>
+class DetectAwaitable {
+
+    public:
+
+        DetectAwaitable(DETECTOR& detector,
+                        EXECUTOR& executor,
+                        const uint8_t* const frame_buff,
+                        const size_t size,
+                        const uint8_t threshold) noexcept :
+            m_detector(detector),
+            m_executor(executor),
+            m_frame_buff(frame_buff),
+            m_size(size),
+            m_threshold(threshold)
+            {}
+
+        bool await_ready() const noexcept {
+
+            return false;
+        }
+
+        // the coroutine may be resumed on another thread before `execute` even returns,
+        // so nothing is to be touched past that point
+        void await_suspend(const std::coroutine_handle<> handle) noexcept {
+
+            m_executor.execute(handle);
+        }
+
+        int await_resume() noexcept {
+
+            return m_detector.detect(m_frame_buff, m_size, m_threshold);
+        }
+
+    private:
+
+        DETECTOR& m_detector;
+        EXECUTOR& m_executor;
+        const uint8_t* const m_frame_buff;
+        const size_t m_size;
+        const uint8_t m_threshold;
+};
+
+/// \brief Detects motion in a frame on an executor, asynchronously.
+///
+/// \param detector    Detector to use.
+/// \param executor    Executor to run decoding and detection on (see
+///                    DetectAwaitable).
+/// \param frame_buff  Same as for the detector's `detect()`.
+/// \param size        Same as for the detector's `detect()`.
+/// \param threshold   Same as for the detector's `detect()`.
+/// \return            Awaitable yielding the result of the detector's
+///                    `detect()`.
+///
+/// For example, within a DetectionTask:
+/// \code
+///     const int movements_count = co_await mdetect::detect_async(detector, executor, frame.data, frame.size);
+///
+///     for (const auto& bbox : detector.bboxes()) { ... }
+/// \endcode
+/// The loop over bounding boxes above runs on the executor's thread.
+template<typename DETECTOR, typename EXECUTOR>
+DetectAwaitable<DETECTOR, EXECUTOR> detect_async(DETECTOR& detector,
+                                                 EXECUTOR& executor,
+                                                 const uint8_t* const frame_buff,
+                                                 const size_t size,
+                                                 const uint8_t threshold = 127) noexcept {
+
+    return {detector, executor, frame_buff, size, threshold};
+}
+
+/// \brief Fire-and-forget coroutine type for detection loops.
+///
+/// Starts running as soon as it is called and destroys its frame once it
+/// completes. The coroutine frame is the only allocation, made once per
+/// coroutine rather than per frame processed. It comes from the global
+/// `operator new` unless the coroutine takes `std::allocator_arg_t` followed
+/// by an allocator as its first two parameters, in which case that allocator
+/// is used (rebound to `std::byte`, it must provide memory suitably aligned
+/// for the coroutine frame, like `std::allocator` does):
+/// \code
+///     mdetect::DetectionTask camera_loop(std::allocator_arg_t, Alloc alloc, Camera& camera, Executor& executor) {
+///
+///         while (const auto frame = co_await camera.next_frame()) {
+///
+///             co_await mdetect::detect_async(camera.detector, executor, frame.data, frame.size);
+///             ...
+///         }
+///     }
+///
+///     camera_loop(std::allocator_arg, pool_allocator, camera, executor);
+/// \endcode
+/// The coroutine runs on the calling thread up to its first suspension, and
+/// on whichever thread resumed it afterwards: past a detect_async(), on the
+/// executor's. Exceptions escaping the coroutine terminate the program.
+class DetectionTask {
+
+    public:
+
+        class promise_type {
+
+            public:
+
+                DetectionTask get_return_object() noexcept {
+
+                    return {};
+                }
+
+                std::suspend_never initial_suspend() const noexcept {
+
+                    return {};
+                }
+
+                std::suspend_never final_suspend() const noexcept {
+
+                    return {};
+                }
+
+                void return_void() const noexcept {}
+
+                void unhandled_exception() const noexcept {
+
+                    std::terminate();
+                }
+        };
+
+        /// \brief Promise of coroutines taking an allocator as their first two parameters.
+        ///
+        /// \tparam ALLOC  Allocator type, as declared by the coroutine.
+        /// \tparam ARGS   Types of the coroutine's other parameters.
+        ///
+        /// Selected through the std::coroutine_traits specialization below.
+        /// The allocator is kept past the end of the coroutine frame so that
+        /// the frame can be given back to it.
+        template<typename ALLOC, typename... ARGS>
+        class allocator_promise_type : public promise_type {
+
+            public:
+
+                static void* operator new(const size_t size, std::allocator_arg_t, const ALLOC& alloc, const ARGS&...) {
+
+                    ByteAlloc byte_alloc(alloc);
+                    std::byte* const frame = std::allocator_traits<ByteAlloc>::allocate(byte_alloc, total_size(size));
+
+                    new (frame + allocator_offset(size)) ByteAlloc(std::move(byte_alloc));
+
+                    return frame;
+                }
+
+                static void operator delete(void* const frame_ptr, const size_t size) noexcept {
+
+                    std::byte* const frame = static_cast<std::byte*>(frame_ptr);
+                    ByteAlloc* const stored_alloc = std::launder(reinterpret_cast<ByteAlloc*>(frame + allocator_offset(size)));
+
+                    ByteAlloc byte_alloc(std::move(*stored_alloc));
+                    stored_alloc->~ByteAlloc();
+
+                    std::allocator_traits<ByteAlloc>::deallocate(byte_alloc, frame, total_size(size));
+                }
+
+            private:
+
+                using ByteAlloc = typename std::allocator_traits<std::remove_cvref_t<ALLOC>>::template rebind_alloc<std::byte>;
+
+                // the allocator follows the coroutine frame
+                static constexpr size_t allocator_offset(const size_t size) noexcept {
+
+                    return (size + alignof(ByteAlloc) - 1) / alignof(ByteAlloc) * alignof(ByteAlloc);
+                }
+
+                static constexpr size_t total_size(const size_t size) noexcept {
+
+                    return allocator_offset(size) + sizeof(ByteAlloc);
+                }
+        };
+};
+
+}  // namespace mdetect
+
+/// \brief Makes coroutines returning mdetect::DetectionTask allocate their frame from the allocator they take.
+template<typename ALLOC, typename... ARGS>
+struct std::coroutine_traits<mdetect::DetectionTask, std::allocator_arg_t, ALLOC, ARGS...> {
+
+    using promise_type = mdetect::DetectionTask::allocator_promise_type<ALLOC, ARGS...>;
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 #include <cstring>
 #include <algorithm>
 #include <new>
@@ -14,6 +15,87 @@
 
 namespace mdetect {
 
+/// \brief Outcome of the last motion detection.
+enum class DetectionStatus : uint8_t {
+
+    ok,             ///< Frames compared, movements detected (if any) stored as bounding boxes.
+    global_change   ///< Nearly the whole frame changed (e.g. lights switched on), no bounding boxes stored.
+};
+
+/// \brief Read-only range over bounding boxes of detected movements.
+///
+/// Supports range-based for loops. Valid until the next detection.
+struct BoundingBoxRange {
+
+    const mdjpeg::BoundingBox* first {nullptr};
+    const mdjpeg::BoundingBox* last {nullptr};
+
+    const mdjpeg::BoundingBox* begin() const noexcept {
+
+        return first;
+    }
+
+    const mdjpeg::BoundingBox* end() const noexcept {
+
+        return last;
+    }
+
+    size_t size() const noexcept {
+
+        return last - first;
+    }
+
+    bool empty() const noexcept {
+
+        return first == last;
+    }
+};
+
+/// \brief Snapshot of the outcome of a motion detection.
+///
+/// \tparam MAX_BBOXES_COUNT  The maximum number of bounding boxes stored.
+///
+/// A plain, fixed-size copy of everything a detection produced, independent
+/// of the detector's state, so that it can be handed over to other threads
+/// (see SnapshotPublisher).
+template<uint8_t MAX_BBOXES_COUNT>
+struct DetectionResult {
+
+    uint32_t frame_id {};                               ///< Identifier of the frame, as given by the caller.
+    DetectionStatus status {DetectionStatus::ok};       ///< Outcome of the detection.
+    uint8_t bboxes_count {};                            ///< Number of valid entries in `bboxes`.
+    mdjpeg::BoundingBox bboxes[MAX_BBOXES_COUNT] {};    ///< Bounding boxes of detected movements, in the order of CoreMotionDetector::get_bounding_box().
+    uint64_t diff_sum {};                               ///< Sum of absolute differences between frames.
+    uint32_t changed_count {};                          ///< Count of pixels changed by more than the threshold.
+    uint32_t pixels_count {};                           ///< Count of pixels compared.
+};
+
+/// \brief Tuning parameters of CoreMotionDetector::detect().
+struct DetectionParams {
+
+    uint8_t threshold {127};            ///< Minimum absolute value for a change in pixel intensity between frames to be considered as due to movement.
+    uint8_t granularity {1};            ///< Level of detail for movements mask. Determines the minimum distance separating distinct submasks, as well as the padding around them.
+    uint8_t noise_removal {0};          ///< Size of the structuring element for morphological opening of the thresholded mask. Movements smaller than that are removed as noise. \c 0 or \c 1 disables noise removal.
+    uint8_t mean_diff_limit {0};        ///< Mean absolute difference between frames at or above which the change is considered global. \c 0 disables the check.
+    uint8_t changed_percent_limit {0};  ///< Percentage of pixels above `threshold` at or above which the change is considered global. \c 0 disables the check.
+    uint8_t merge_distance {0};         ///< Bounding boxes closer to each other than that (in pixels, along both axes) are merged into one. \c 0 disables merging by distance, \c 1 merges touching and overlapping bounding boxes.
+    uint8_t merge_iou_percent {0};      ///< Overlapping bounding boxes with intersection over union (in percent) of at least that are merged into one. \c 0 disables merging by overlap.
+};
+
+/// \brief Per-tile inputs and outputs of CoreMotionDetector::detect().
+///
+/// Each buffer holds one entry per tile of `tile_size` x `tile_size` pixels,
+/// row of tiles by row of tiles (the last ones may be partial). All of them
+/// are optional.
+struct TileBuffers {
+
+    uint8_t tile_size {};                   ///< Width (and height) of tiles in pixels. Ignored if all the buffers are \c nullptr.
+    const uint8_t* thresholds {nullptr};    ///< Per-tile thresholds used instead of DetectionParams::threshold. \c nullptr uses that one throughout.
+    uint32_t* diff_sums {nullptr};          ///< Buffer for per-tile sums of absolute differences between the first and the second image.
+    const uint8_t* skip_mask {nullptr};     ///< Non-zero for tiles to leave out of detection. \c nullptr skips none.
+    uint16_t* changed_counts {nullptr};     ///< Buffer for per-tile counts of changed pixels (including the tiles skipped).
+};
+
 /// \brief Low-level motion detection class.
 ///
 /// \tparam MAX_BBOXES_COUNT  The maximum number of bounding boxes to store.
@@ -51,10 +133,108 @@ class CoreMotionDetector {
         /// \param granularity           Level of detail for movements mask. Determines the minimum distance separating distinct submasks, as well as the padding around them.
         /// \return                      Total count of movement regions detected.
         ///
+        /// Plain two-frame detection, i.e. the overload below with no older
+        /// frames, no per-tile buffers and default DetectionParams apart from
+        /// `threshold` and `granularity`.
+        uint detect(uint8_t* const image1_frame_buff,
+                    uint8_t* const image2_frame_buff,
+                    uint8_t* const aux1_frame_buff,
+                    uint8_t* const aux2_frame_buff,
+                    uint8_t* const bbox_buff,
+                    const size_t   bbox_buff_size,
+                    const uint16_t frame_width,
+                    const uint16_t frame_height,
+                    const uint8_t  threshold,
+                    const uint8_t  granularity) noexcept {
+
+            DetectionParams params;
+            params.threshold = threshold;
+            params.granularity = granularity;
+
+            return detect(image1_frame_buff,
+                          image2_frame_buff,
+                          nullptr,
+                          0,
+                          aux1_frame_buff,
+                          aux2_frame_buff,
+                          bbox_buff,
+                          bbox_buff_size,
+                          frame_width,
+                          frame_height,
+                          params,
+                          TileBuffers());
+        }
+
+        /// \brief Compares two frame buffers and detects movement regions between them.
+        ///
+        /// \param image1_frame_buff     Frame buffer of the first image (of size `frame_width * frame_height` bytes).
+        /// \param image2_frame_buff     Frame buffer of the second image (of size `frame_width * frame_height` bytes).
+        /// \param older_frame_buffs     Frame buffers of images preceding the second one, newest first (each of size `frame_width * frame_height` bytes). Can be \c nullptr if `older_frames_count` is \c 0.
+        /// \param older_frames_count    Number of frame buffers in `older_frame_buffs`.
+        /// \param aux1_frame_buff       First auxiliary frame buffer (of size `frame_width * frame_height` bytes). Can alias one of the above.
+        /// \param aux2_frame_buff       Second auxiliary frame buffer (of size `frame_width * frame_height` bytes). Can alias `aux1_frame_buff`.
+        /// \param bbox_buff             A buffer needed in computing the bounding boxes.
+        /// \param bbox_buff_size        Size of the `bbox_buff` in bytes.
+        /// \param frame_width           Width of the image frame in pixels.
+        /// \param frame_height          Height of the image frame in pixels.
+        /// \param params                Thresholding, noise removal, global change and merging parameters.
+        /// \param tiles                 Per-tile thresholds and statistics (see TileBuffers).
+        /// \return                      Total count of movement regions detected.
+        ///
         /// Detected regions are internally stored as bounding boxes which can
         /// be retrieved by calling get_bounding_box(). Calling detect() resets
         /// any previously stored bounding boxes.
         ///
+        /// \par Global changes
+        /// A change in illumination (lights switched on, a passing cloud...)
+        /// changes nearly every pixel. Dilating and labeling such a mask would
+        /// only exhaust the labels and yield a single frame-sized bounding box.
+        /// Instead, the statistics gathered by the absolute difference and
+        /// thresholding passes are checked against the limits and, if either
+        /// is reached, detection is aborted before dilation. No bounding boxes
+        /// are stored in that case and get_status() reports
+        /// DetectionStatus::global_change.
+        ///
+        /// \par Multi-frame differencing
+        /// Differencing two frames marks both the old and the new position of
+        /// a moving object. If older frames are given, the thresholded
+        /// difference between the first and the second image is intersected
+        /// with those between the first image and each older one. What is
+        /// left are the areas where the first image differs from all the
+        /// others, i.e. objects at their position in the first image (areas
+        /// uncovered by an object are only different in the frame it moved
+        /// away in). The first image must be the current one and must not be
+        /// aliased by `aux1_frame_buff` in that case. Global changes are
+        /// checked against the first difference only.
+        ///
+        /// \par Per-tile thresholds
+        /// A single threshold does not fit dark, noisy areas and bright,
+        /// stable ones at the same time. Given per-tile thresholds (e.g.
+        /// derived from the per-tile sums of differences of previous frames,
+        /// see JpegMotionDetector::set_adaptive_threshold()), each tile is
+        /// thresholded separately, in spans as branch-free as with a single
+        /// threshold. The per-tile sums come from the absolute difference pass
+        /// at virtually no extra cost and are available even if detection is
+        /// aborted due to a global change.
+        ///
+        /// \par Skipping tiles
+        /// Regions which change all the time (flags, screens, water...) can
+        /// be left out of detection by skipping the tiles covering them. The
+        /// changes in them are cleared before dilation so that they neither
+        /// use up labels nor grow into neighboring tiles. They are counted per
+        /// tile beforehand, so their activity can still be monitored (see
+        /// JpegMotionDetector::set_activity_masking()).
+        ///
+        /// \par Merging and ranking
+        /// Connected movement regions are labeled in scan order and, by
+        /// default, the first \c MAX_BBOXES_COUNT of their bounding boxes are
+        /// stored in that order. If either `merge_distance` or
+        /// `merge_iou_percent` is set, the bounding boxes are first merged
+        /// accordingly (using a coarse spatial grid so that only boxes sharing
+        /// grid cells are ever compared) and ranked by area instead. At most
+        /// \c MAX_BBOXES_COUNT of the largest ones are stored then, largest
+        /// first.
+        ///
         /// \par Choosing the size for \c bbox_buff
         /// A temporary storage for bounding boxes (at 8 bytes per bounding box)
         /// is needed for detection. At most 256 bounding boxes can be used
@@ -68,117 +248,246 @@ class CoreMotionDetector {
         /// \c granularity.
         uint detect(uint8_t* const image1_frame_buff,
                     uint8_t* const image2_frame_buff,
+                    uint8_t* const* const older_frame_buffs,
+                    const uint8_t  older_frames_count,
                     uint8_t* const aux1_frame_buff,
                     uint8_t* const aux2_frame_buff,
                     uint8_t* const bbox_buff,
                     const size_t   bbox_buff_size,
                     const uint16_t frame_width,
                     const uint16_t frame_height,
-                    const uint8_t  threshold,
-                    const uint8_t  granularity) noexcept {
+                    const DetectionParams& params,
+                    const TileBuffers& tiles) noexcept {
 
             const Image curr_img(image1_frame_buff, frame_width, frame_height);
             const Image ref_img(image2_frame_buff, frame_width, frame_height);
             Image aux1_img(aux1_frame_buff, frame_width, frame_height);
             Image aux2_img(aux2_frame_buff, frame_width, frame_height);
 
-            // calculate pixel-wise absolute difference between frames
-            mdetect::transform::absdiff(aux1_img, curr_img, ref_img);
+            const uint64_t pixels_count = frame_width * frame_height;
 
-            // posterize to 1-bit using custom threshold value
-            mdetect::transform::threshold(aux1_img, aux1_img, threshold);
+            // calculate pixel-wise absolute difference between frames (along with per-tile sums if requested)
+            uint64_t diff_sum = 0;
+
+            const uint32_t tiles_count = tiles.tile_size ?
+                ((frame_width + tiles.tile_size - 1) / tiles.tile_size) * ((frame_height + tiles.tile_size - 1) / tiles.tile_size) :
+                0;
+
+            if (tiles.diff_sums) {
+
+                std::fill_n(tiles.diff_sums, tiles_count, 0);
+
+                diff_sum = mdetect::transform::absdiff(aux1_img, curr_img, ref_img, tiles.diff_sums, tiles.tile_size);
+            }
+
+            else {
+
+                diff_sum = mdetect::transform::absdiff(aux1_img, curr_img, ref_img);
+            }
+
+            // keep frame statistics for get_result()
+            m_diff_sum = diff_sum;
+            m_changed_count = 0;
+            m_pixels_count = pixels_count;
+
+            // a global change in brightness shifts the mean of the whole difference image
+            if (params.mean_diff_limit && diff_sum >= params.mean_diff_limit * pixels_count) {
+
+                return abort_on_global_change();
+            }
+
+            // posterize to 1-bit using custom threshold value(s)
+            const uint64_t changed_count = tiles.thresholds ?
+                mdetect::transform::threshold(aux1_img, aux1_img, tiles.thresholds, tiles.tile_size) :
+                mdetect::transform::threshold(aux1_img, aux1_img, params.threshold);
+
+            m_changed_count = changed_count;
+
+            // as does a strong one to the majority of pixels
+            if (params.changed_percent_limit && 100 * changed_count >= params.changed_percent_limit * pixels_count) {
+
+                return abort_on_global_change();
+            }
+
+            m_status = DetectionStatus::ok;
+
+            // keep only the changes with respect to all the older frames as well
+            for (uint8_t older_idx = 0; older_idx < older_frames_count; ++older_idx) {
+
+                const Image older_img(older_frame_buffs[older_idx], frame_width, frame_height);
+
+                if (tiles.thresholds) {
+
+                    mdetect::transform::intersect_changes(aux1_img, curr_img, older_img, tiles.thresholds, tiles.tile_size);
+                }
+
+                else {
+
+                    mdetect::transform::intersect_changes(aux1_img, curr_img, older_img, params.threshold);
+                }
+            }
+
+            // count the changes per tile and clear those in the tiles skipped
+            if (tiles.skip_mask || tiles.changed_counts) {
+
+                if (tiles.changed_counts) {
+
+                    std::fill_n(tiles.changed_counts, tiles_count, 0);
+                }
+
+                mdetect::transform::mask_tiles(aux1_img, tiles.skip_mask, tiles.changed_counts, tiles.tile_size);
+            }
+
+            // remove specks smaller than `noise_removal` x `noise_removal` block
+            // before dilation grows each of them into a separate movement
+            if (params.noise_removal > 1) {
+
+                mdetect::transform::open(aux1_img, aux1_img, params.noise_removal);
+            }
 
             // dilate with square block of size `granularity` x `granularity`
-            mdetect::transform::dilate(aux2_img, aux1_img, granularity);
+            mdetect::transform::dilate(aux2_img, aux1_img, params.granularity);
 
             // set temporary bounding box buffer
             const uint capacity = set_bbox_buffer(bbox_buff, bbox_buff_size);
 
-            // set default img value for probing beyond its boundaries
-            const uint8_t padding_value = 0;
-
             // labeling of areas with detected "movements" starts with 1
             uint next_label = 1;
 
             // fit a tight (after dilation) bounding box around each "movement" area
             // (boxed connected components)
-            for (int row = 0; (row < aux2_img.height) && next_label < capacity; ++row) {
+            for (uint16_t row = 0; (row < frame_height) && next_label < capacity; ++row) {
 
-                for (int col = 0; (col < aux2_img.width) && next_label < capacity; ++col) {
+                uint8_t* const row_labels = &aux2_frame_buff[row * frame_width];
 
-                    // if the current pixel value is non-zero
-                    if (aux2_img.at(row, col)) {
+                label_row(row_labels, row ? row_labels - frame_width : nullptr, row, frame_width, next_label, capacity);
+            }
+
+            return store_labeled_bboxes(next_label, frame_width, frame_height, params.merge_distance, params.merge_iou_percent);
+        }
 
-                        const uint8_t W_label = aux2_img.at(row, col - 1, padding_value);
+        /// \brief Labels a single row of the dilated movements mask.
+        ///
+        /// \param row_labels       Row of the dilated movements mask (non-zero for movement), labeled in place.
+        /// \param prev_row_labels  The row above, already labeled, or \c nullptr for the first row.
+        /// \param row              Y-coordinate of the row.
+        /// \param frame_width      Width of the row in pixels.
+        /// \param next_label       The next unused label (\c 1 before the first row), advanced as new labels are used.
+        /// \param capacity         Number of labels available, as returned by set_bbox_buffer().
+        ///
+        /// Bounding boxes of labeled regions are grown over the row in the
+        /// temporary buffer. Labeling stops once `next_label` reaches
+        /// `capacity`. A building block of detect(), exposed for subclasses
+        /// producing the mask row by row (see JpegMotionDetector::detect_streaming()).
+        void label_row(uint8_t* const row_labels,
+                       const uint8_t* const prev_row_labels,
+                       const uint16_t row,
+                       const uint16_t frame_width,
+                       uint& next_label,
+                       const uint capacity) noexcept {
 
-                        uint8_t N_label = aux2_img.at(row - 1, col, padding_value);
+            for (uint16_t col = 0; (col < frame_width) && next_label < capacity; ++col) {
 
-                        // resolve `N_label` to its root node label
-                        if (!m_bboxes[N_label].merge_rec.is_root_node) {
+                // if the current pixel value is non-zero
+                if (row_labels[col]) {
 
-                            N_label = m_bboxes[N_label].merge_rec.root_label;
-                        }
+                    const uint8_t W_label = col ? row_labels[col - 1] : 0;
 
-                        // if W label is non-zero
-                        if (W_label) {
+                    uint8_t N_label = prev_row_labels ? prev_row_labels[col] : 0;
 
-                            // if N label is non-zero and different to W label
-                            if (N_label && (N_label != W_label)) {
+                    // resolve `N_label` to its root node label
+                    if (!m_bboxes[N_label].merge_rec.is_root_node) {
 
-                                const auto [smaller, larger] = std::minmax(N_label, W_label);
+                        N_label = m_bboxes[N_label].merge_rec.root_label;
+                    }
 
-                                // assign smaller label to the current pixel
-                                aux2_img.at(row, col) = smaller;
+                    // if W label is non-zero
+                    if (W_label) {
 
-                                // grow smaller label bounding box over the larger label one
-                                m_bboxes[smaller].bbox.merge(m_bboxes[larger].bbox);
+                        // if N label is non-zero and different to W label
+                        if (N_label && (N_label != W_label)) {
 
-                                // set smaller label to be the larger label's root node
-                                m_bboxes[larger].merge_rec.is_root_node = false;
-                                m_bboxes[larger].merge_rec.root_label = smaller;
-                           }
+                            const auto [smaller, larger] = std::minmax(N_label, W_label);
 
-                            // ignore the N label
-                            else {
+                            // assign smaller label to the current pixel
+                            row_labels[col] = smaller;
 
-                                // assign W label to the current pixel
-                                aux2_img.at(row, col) = W_label;
+                            // grow smaller label bounding box over the larger label one
+                            m_bboxes[smaller].bbox.merge(m_bboxes[larger].bbox);
 
-                                // grow W label bounding box over the current pixel
-                                m_bboxes[W_label].bbox.merge(mdjpeg::BoundingBox(col, row));
-                            }
-                        }
+                            // set smaller label to be the larger label's root node
+                            m_bboxes[larger].merge_rec.is_root_node = false;
+                            m_bboxes[larger].merge_rec.root_label = smaller;
+                       }
 
-                        // ignore the W label
-                        else if (N_label) {
+                        // ignore the N label
+                        else {
 
-                            // assign N label to the current pixel
-                            aux2_img.at(row, col) = N_label;
+                            // assign W label to the current pixel
+                            row_labels[col] = W_label;
 
-                            // grow N label bounding box over the current pixel
-                            m_bboxes[N_label].bbox.merge(mdjpeg::BoundingBox(col, row));
+                            // grow W label bounding box over the current pixel
+                            m_bboxes[W_label].bbox.merge(mdjpeg::BoundingBox(col, row));
                         }
+                    }
 
-                        // else both W and N neighbors are zero -> create new bounding box
-                        else {
+                    // ignore the W label
+                    else if (N_label) {
+
+                        // assign N label to the current pixel
+                        row_labels[col] = N_label;
 
-                            // define a new bounding box for the current pixel
-                            m_bboxes[next_label].bbox = mdjpeg::BoundingBox(col, row);
+                        // grow N label bounding box over the current pixel
+                        m_bboxes[N_label].bbox.merge(mdjpeg::BoundingBox(col, row));
+                    }
 
-                            // assign a new label to the current pixel
-                            aux2_img.at(row, col) = next_label;
+                    // else both W and N neighbors are zero -> create new bounding box
+                    else {
 
-                            ++next_label;
-                        }
+                        // define a new bounding box for the current pixel
+                        m_bboxes[next_label].bbox = mdjpeg::BoundingBox(col, row);
+
+                        // assign a new label to the current pixel
+                        row_labels[col] = next_label;
+
+                        ++next_label;
                     }
                 }
             }
+        }
+
+        /// \brief Merges, ranks and stores bounding boxes of the labeled movement regions.
+        ///
+        /// \param next_label         The next unused label after labeling the last row.
+        /// \param frame_width        Width of the image frame in pixels.
+        /// \param frame_height       Height of the image frame in pixels.
+        /// \param merge_distance     See detect().
+        /// \param merge_iou_percent  See detect().
+        /// \return                   Count of bounding boxes stored.
+        ///
+        /// Final step of detect(), following label_row() for all the rows.
+        uint store_labeled_bboxes(const uint next_label,
+                                  const uint16_t frame_width,
+                                  const uint16_t frame_height,
+                                  const uint8_t merge_distance,
+                                  const uint8_t merge_iou_percent) noexcept {
 
             // reset bounding box counter used by `get_bounding_box`
             m_next_bbox_idx = 0;
 
-            // copy bounding boxes with root node labels to private storage buffer
-            m_stored_bbox_count = store_valid_bboxes(next_label);
+            // gather bounding boxes with root node labels at the front of the temporary buffer
+            uint bboxes_count = gather_root_bboxes(next_label);
+
+            // if enabled, merge bounding boxes that are too close to or overlapping too much with
+            // each other and move the largest ones to the front
+            if (merge_distance || merge_iou_percent) {
+
+                bboxes_count = merge_bboxes(bboxes_count, frame_width, frame_height, merge_distance, merge_iou_percent);
+                bboxes_count = rank_bboxes(bboxes_count);
+            }
+
+            // copy bounding boxes from the front to private storage buffer
+            m_stored_bbox_count = store_valid_bboxes(bboxes_count);
 
             return m_stored_bbox_count;
         }
@@ -189,6 +498,10 @@ class CoreMotionDetector {
         ///
         /// If no movements are detected, always returns a null-box.
         /// Otherwise, after the sentinel, restarts with the first box.
+        ///
+        /// Bounding boxes come in scan order (of their topmost row, then of
+        /// their leftmost pixel in that row) unless merging is enabled, in
+        /// which case they come largest first (see detect()).
         mdjpeg::BoundingBox get_bounding_box() noexcept {
 
             mdjpeg::BoundingBox next_bbox;
@@ -206,7 +519,56 @@ class CoreMotionDetector {
             return next_bbox;
         }
 
-    private:
+        /// \brief Retrieves all the stored bounding boxes at once.
+        ///
+        /// \return  Range over bounding boxes around detected movements, in
+        ///          the order of get_bounding_box().
+        ///
+        /// An alternative to the get_bounding_box() protocol that neither
+        /// needs a sentinel nor changes the state of the detector:
+        /// \code
+        ///     for (const auto& bbox : detector.bboxes()) { ... }
+        /// \endcode
+        BoundingBoxRange bboxes() const noexcept {
+
+            return {m_bboxes_buff, m_bboxes_buff + m_stored_bbox_count};
+        }
+
+        /// \brief Retrieves the outcome of the last call to detect().
+        DetectionStatus get_status() const noexcept {
+
+            return m_status;
+        }
+
+        /// \brief Takes a snapshot of the outcome of the last call to detect().
+        ///
+        /// \param frame_id  Identifier of the frame to tag the snapshot with.
+        /// \param result    Snapshot to fill in.
+        ///
+        /// Unlike get_bounding_box(), does not change the state of the
+        /// detector. If detection was aborted due to a global change, the
+        /// statistics are those gathered up to that point.
+        void get_result(const uint32_t frame_id, DetectionResult<MAX_BBOXES_COUNT>& result) const noexcept {
+
+            result.frame_id = frame_id;
+            result.status = m_status;
+            result.bboxes_count = m_stored_bbox_count;
+            std::copy_n(m_bboxes_buff, m_stored_bbox_count, result.bboxes);
+            std::fill(&result.bboxes[m_stored_bbox_count], &result.bboxes[MAX_BBOXES_COUNT], mdjpeg::BoundingBox());
+            result.diff_sum = m_diff_sum;
+            result.changed_count = m_changed_count;
+            result.pixels_count = m_pixels_count;
+        }
+
+        // resets stored bounding boxes and reports a global change instead
+        uint abort_on_global_change() noexcept {
+
+            m_status = DetectionStatus::global_change;
+            m_next_bbox_idx = 0;
+            m_stored_bbox_count = 0;
+
+            return 0;
+        }
 
         // sets `m_bboxes` to correctly aligned address within provided buffer
         // returns the capacity in number of elements
@@ -247,23 +609,264 @@ class CoreMotionDetector {
             return useful_capacity;
         }
 
-        // internally stores valid bounding boxes from temporary buffer for
-        // subsequent retrieval by `get_bounding_box`
-        virtual uint store_valid_bboxes(uint higher_bound) noexcept {
+    private:
+
+        // compacts bounding boxes with root node labels to the front of the
+        // temporary buffer, returns their count
+        uint gather_root_bboxes(const uint higher_bound) noexcept {
 
             uint dst_idx = 0;
 
-            for (uint src_idx = 1; src_idx < higher_bound && dst_idx < MAX_BBOXES_COUNT; ++src_idx) {
+            for (uint src_idx = 1; src_idx < higher_bound; ++src_idx) {
 
                 if (m_bboxes[src_idx].merge_rec.is_root_node) {
 
-                    m_bboxes_buff[dst_idx++] = m_bboxes[src_idx].bbox;
+                    m_bboxes[dst_idx++].bbox = m_bboxes[src_idx].bbox;
+                }
+            }
+
+            return dst_idx;
+        }
+
+        // merges gathered bounding boxes closer than `merge_distance` or overlapping
+        // by at least `merge_iou_percent`, returns the count of remaining ones
+        // (compacted to the front of the temporary buffer)
+        uint merge_bboxes(const uint bboxes_count,
+                          const uint16_t frame_width,
+                          const uint16_t frame_height,
+                          const uint8_t merge_distance,
+                          const uint8_t merge_iou_percent) noexcept {
+
+            if (bboxes_count < 2) {
+
+                return bboxes_count;
+            }
+
+            // each bounding box is registered with the grid cells it covers, so
+            // candidates for merging are only looked for among the ones sharing
+            // cells with it (once grown by `merge_distance`)
+            const uint cell_width = std::max(1U, (frame_width + GRID_SIZE - 1) / GRID_SIZE);
+            const uint cell_height = std::max(1U, (frame_height + GRID_SIZE - 1) / GRID_SIZE);
+
+            BBoxSet alive;
+            for (uint idx = 0; idx < bboxes_count; ++idx) {
+
+                alive.insert(idx);
+            }
+
+            // merged bounding boxes grow and may come close to others, repeat until stable
+            bool is_any_merged = true;
+            while (is_any_merged) {
+
+                is_any_merged = false;
+
+                BBoxSet grid[GRID_SIZE][GRID_SIZE] {};
+                for (uint idx = alive.find_next(0); idx < bboxes_count; idx = alive.find_next(idx + 1)) {
+
+                    const CellRange cells(m_bboxes[idx].bbox, 0, cell_width, cell_height);
+                    for (uint grid_row = cells.first_row; grid_row <= cells.last_row; ++grid_row) {
+
+                        for (uint grid_col = cells.first_col; grid_col <= cells.last_col; ++grid_col) {
+
+                            grid[grid_row][grid_col].insert(idx);
+                        }
+                    }
+                }
+
+                // bounding boxes merged into others on the way are erased, so they are skipped
+                for (uint idx = alive.find_next(0); idx < bboxes_count; idx = alive.find_next(idx + 1)) {
+
+                    mdjpeg::BoundingBox& bbox = m_bboxes[idx].bbox;
+
+                    BBoxSet candidates;
+                    const CellRange cells(bbox, merge_distance, cell_width, cell_height);
+                    for (uint grid_row = cells.first_row; grid_row <= cells.last_row; ++grid_row) {
+
+                        for (uint grid_col = cells.first_col; grid_col <= cells.last_col; ++grid_col) {
+
+                            candidates.unite(grid[grid_row][grid_col]);
+                        }
+                    }
+
+                    // only the candidates are visited, each pair from its lower index
+                    for (uint other_idx = candidates.find_next(idx + 1); other_idx < bboxes_count; other_idx = candidates.find_next(other_idx + 1)) {
+
+                        if (alive.contains(other_idx) &&
+                            is_merge_needed(bbox, m_bboxes[other_idx].bbox, merge_distance, merge_iou_percent)) {
+
+                            bbox.merge(m_bboxes[other_idx].bbox);
+                            alive.erase(other_idx);
+                            is_any_merged = true;
+                        }
+                    }
+                }
+            }
+
+            uint dst_idx = 0;
+
+            for (uint src_idx = 0; src_idx < bboxes_count; ++src_idx) {
+
+                if (alive.contains(src_idx)) {
+
+                    m_bboxes[dst_idx++].bbox = m_bboxes[src_idx].bbox;
                 }
             }
 
             return dst_idx;
         }
 
+        static bool is_merge_needed(const mdjpeg::BoundingBox& bbox1,
+                                    const mdjpeg::BoundingBox& bbox2,
+                                    const uint8_t merge_distance,
+                                    const uint8_t merge_iou_percent) noexcept {
+
+            // gaps between bounding boxes along each axis (negative when overlapping)
+            const int32_t gap_X = std::max(bbox1.topleft_X, bbox2.topleft_X) - std::min(bbox1.bottomright_X, bbox2.bottomright_X);
+            const int32_t gap_Y = std::max(bbox1.topleft_Y, bbox2.topleft_Y) - std::min(bbox1.bottomright_Y, bbox2.bottomright_Y);
+
+            if (merge_distance && gap_X < merge_distance && gap_Y < merge_distance) {
+
+                return true;
+            }
+
+            if (merge_iou_percent && gap_X < 0 && gap_Y < 0) {
+
+                const uint64_t intersection = static_cast<uint64_t>(-gap_X) * -gap_Y;
+                const uint64_t union_area = area(bbox1) + area(bbox2) - intersection;
+
+                return 100 * intersection >= merge_iou_percent * union_area;
+            }
+
+            return false;
+        }
+
+        static uint32_t area(const mdjpeg::BoundingBox& bbox) noexcept {
+
+            return static_cast<uint32_t>(bbox.width()) * bbox.height();
+        }
+
+        // moves the largest (at most `MAX_BBOXES_COUNT`) of the gathered bounding boxes to the
+        // front of the temporary buffer, ordered by decreasing area, returns their count
+        uint rank_bboxes(const uint bboxes_count) noexcept {
+
+            uint ranked_count = 0;
+
+            for (uint src_idx = 0; src_idx < bboxes_count; ++src_idx) {
+
+                // the front never reaches past `src_idx`, so shifting cannot overwrite the boxes not ranked yet
+                const mdjpeg::BoundingBox bbox = m_bboxes[src_idx].bbox;
+                const uint32_t bbox_area = area(bbox);
+
+                // insertion point after all the ones at least as large (retains scan order among equals)
+                uint dst_idx = ranked_count;
+                while (dst_idx > 0 && area(m_bboxes[dst_idx - 1].bbox) < bbox_area) {
+
+                    --dst_idx;
+                }
+
+                if (dst_idx >= MAX_BBOXES_COUNT) {
+
+                    continue;
+                }
+
+                // make room by shifting smaller ones back (dropping the smallest one if full)
+                ranked_count = std::min<uint>(ranked_count + 1, MAX_BBOXES_COUNT);
+                for (uint idx = ranked_count - 1; idx > dst_idx; --idx) {
+
+                    m_bboxes[idx].bbox = m_bboxes[idx - 1].bbox;
+                }
+
+                m_bboxes[dst_idx].bbox = bbox;
+            }
+
+            return ranked_count;
+        }
+
+        // internally stores the bounding boxes from the front of temporary buffer
+        // for subsequent retrieval by `get_bounding_box`, returns their count
+        // NOTE: `bboxes_count` is the count of root node bounding boxes already
+        // gathered (and possibly merged and ranked) at the front of the buffer,
+        // no longer the higher bound on labels to scan for root nodes
+        virtual uint store_valid_bboxes(const uint bboxes_count) noexcept {
+
+            const uint stored_count = std::min<uint>(bboxes_count, MAX_BBOXES_COUNT);
+
+            for (uint idx = 0; idx < stored_count; ++idx) {
+
+                m_bboxes_buff[idx] = m_bboxes[idx].bbox;
+            }
+
+            return stored_count;
+        }
+
+        // size (in cells along each axis) of the spatial grid used for merging bounding boxes
+        static constexpr uint GRID_SIZE = 8;
+
+        // set of bounding boxes from the temporary buffer (by index)
+        struct BBoxSet {
+
+            static constexpr uint CAPACITY = 256;
+
+            uint64_t words[CAPACITY / 64] {};
+
+            void insert(const uint idx) noexcept {
+
+                words[idx / 64] |= uint64_t{1} << (idx % 64);
+            }
+
+            void erase(const uint idx) noexcept {
+
+                words[idx / 64] &= ~(uint64_t{1} << (idx % 64));
+            }
+
+            bool contains(const uint idx) const noexcept {
+
+                return words[idx / 64] & (uint64_t{1} << (idx % 64));
+            }
+
+            void unite(const BBoxSet& other) noexcept {
+
+                for (uint word_idx = 0; word_idx < CAPACITY / 64; ++word_idx) {
+
+                    words[word_idx] |= other.words[word_idx];
+                }
+            }
+
+            // the lowest index in the set at or above `idx`, `CAPACITY` if there is none
+            uint find_next(uint idx) const noexcept {
+
+                while (idx < CAPACITY) {
+
+                    const uint64_t word = words[idx / 64] >> (idx % 64);
+
+                    if (word) {
+
+                        return idx + __builtin_ctzll(word);
+                    }
+
+                    idx = (idx / 64 + 1) * 64;
+                }
+
+                return CAPACITY;
+            }
+        };
+
+        // range of grid cells covered by a bounding box grown by `margin`
+        struct CellRange {
+
+            uint first_col;
+            uint first_row;
+            uint last_col;
+            uint last_row;
+
+            CellRange(const mdjpeg::BoundingBox& bbox, const uint margin, const uint cell_width, const uint cell_height) noexcept :
+                first_col(std::min(GRID_SIZE - 1, (bbox.topleft_X - std::min<uint>(bbox.topleft_X, margin)) / cell_width)),
+                first_row(std::min(GRID_SIZE - 1, (bbox.topleft_Y - std::min<uint>(bbox.topleft_Y, margin)) / cell_height)),
+                last_col(std::min(GRID_SIZE - 1, (bbox.bottomright_X - 1 + margin) / cell_width)),
+                last_row(std::min(GRID_SIZE - 1, (bbox.bottomright_Y - 1 + margin) / cell_height))
+                {}
+        };
+
         // bounding box tagged with a merge record used by `detect` to track the
         // growing bounding boxes
         union LabeledBBox {
@@ -283,7 +886,11 @@ class CoreMotionDetector {
         LabeledBBox* m_bboxes {nullptr};
         uint8_t m_next_bbox_idx {};
         uint8_t m_stored_bbox_count {};
+        DetectionStatus m_status {DetectionStatus::ok};
         mdjpeg::BoundingBox m_bboxes_buff[MAX_BBOXES_COUNT] {};
+        uint64_t m_diff_sum {};
+        uint32_t m_changed_count {};
+        uint32_t m_pixels_count {};
 };
 
 }  // namespace mdetect
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <algorithm>
+
+
+namespace mdetect {
+
+/// \brief Throttles motion detection on streams with no recent movements.
+///
+/// \tparam DETECTOR       Motion detector type (e.g. JpegMotionDetector).
+/// \tparam STREAMS_COUNT  The maximum number of streams to schedule.
+///
+/// Keeps track of the motion history of each stream and runs detection on
+/// every frame only right after activity. Each time a number of consecutive
+/// detections find no movements, the interval between detections (in frames)
+/// doubles, up to the maximum set for the stream, which is its worst-case
+/// detection latency. Any movement or global change resets the interval back
+/// to a single frame.
+///
+/// Skipped frames are not decoded at all, which lets a fixed CPU budget cover
+/// far more mostly static streams. Frames detected on can replace the
+/// reference frame of their detector at no extra decoding (see detect()), so
+/// that it is at most one interval old.
+template<typename DETECTOR, uint8_t STREAMS_COUNT>
+class DetectionScheduler {
+
+    public:
+
+        /// \brief Value returned by detect() for frames skipped.
+        static constexpr int SKIPPED = -3;
+
+        /// \brief Value returned by detect() for streams with no detector attached.
+        static constexpr int NOT_ATTACHED = -4;
+
+        static_assert(SKIPPED != DETECTOR::DECODE_FAILED && SKIPPED != DETECTOR::GLOBAL_CHANGE &&
+                      NOT_ATTACHED != DETECTOR::DECODE_FAILED && NOT_ATTACHED != DETECTOR::GLOBAL_CHANGE,
+                      "scheduler results must be told apart from the detector's");
+
+        /// \param quiet_detections  Number of consecutive detections without
+        ///                          movements after which the interval
+        ///                          between detections doubles.
+        explicit DetectionScheduler(const uint8_t quiet_detections = 4) noexcept :
+            m_quiet_detections(std::max<uint8_t>(quiet_detections, 1))
+            {}
+
+        DetectionScheduler(const DetectionScheduler& other) = delete;
+        DetectionScheduler& operator=(const DetectionScheduler& other) = delete;
+        DetectionScheduler(DetectionScheduler&& other) = delete;
+        DetectionScheduler& operator=(DetectionScheduler&& other) = delete;
+
+        /// \brief Attaches a detector to a stream.
+        ///
+        /// \param stream_idx    Index of the stream.
+        /// \param detector      Detector to run on the frames of the stream.
+        /// \param max_interval  The maximum number of frames between
+        ///                      detections, i.e. the worst-case detection
+        ///                      latency in frames. \c 1 disables throttling.
+        /// \retval              true on success.
+        /// \retval              false if `stream_idx` is out of range.
+        ///
+        /// The stream starts with detection on every frame.
+        bool attach(const uint8_t stream_idx, DETECTOR& detector, const uint16_t max_interval) noexcept {
+
+            if (stream_idx >= STREAMS_COUNT) {
+
+                return false;
+            }
+
+            m_streams[stream_idx] = {};
+            m_streams[stream_idx].detector = &detector;
+            m_streams[stream_idx].max_interval = std::max<uint16_t>(max_interval, 1);
+
+            return true;
+        }
+
+        /// \brief Runs detection on a frame of a stream if it is due.
+        ///
+        /// \param stream_idx        Index of the stream the frame belongs to.
+        /// \param frame_buff        Same as for the detector's `detect()`.
+        /// \param size              Same as for the detector's `detect()`.
+        /// \param threshold         Same as for the detector's `detect()`.
+        /// \param update_reference  Same as for the detector's `detect()`.
+        ///                          Only applies if detection is due.
+        /// \return                  The result of the detector's `detect()` if
+        ///                          detection was due, \c SKIPPED otherwise. If
+        ///                          no detector is attached to the stream,
+        ///                          returns \c NOT_ATTACHED.
+        ///
+        /// Must be called for every frame of the stream, since intervals are
+        /// counted in frames. Frames skipped are left untouched. A frame
+        /// failing to decompress does not count as detected, detection is due
+        /// on the next frame again.
+        int detect(const uint8_t stream_idx,
+                   const uint8_t* const frame_buff,
+                   const size_t size,
+                   const uint8_t threshold = 127,
+                   const bool update_reference = false) noexcept {
+
+            if (stream_idx >= STREAMS_COUNT || !m_streams[stream_idx].detector) {
+
+                return NOT_ATTACHED;
+            }
+
+            Stream& stream = m_streams[stream_idx];
+
+            if (++stream.frames_count < stream.interval) {
+
+                return SKIPPED;
+            }
+
+            const int result = stream.detector->detect(frame_buff, size, threshold, update_reference);
+
+            // keep the worst-case latency even if frames fail to decompress
+            stream.frames_count = (result == DETECTOR::DECODE_FAILED) ? stream.interval - 1 : 0;
+
+            // movements or global changes, keep an eye on the stream
+            if (result > 0 || result == DETECTOR::GLOBAL_CHANGE) {
+
+                stream.interval = 1;
+                stream.quiet_count = 0;
+            }
+
+            // a quiet stream, back off gradually (decompression failures do not count)
+            else if (result == 0 && ++stream.quiet_count == m_quiet_detections) {
+
+                stream.interval = std::min<uint32_t>(2U * stream.interval, stream.max_interval);
+                stream.quiet_count = 0;
+            }
+
+            return result;
+        }
+
+        /// \brief Retrieves the current interval (in frames) between detections on a stream.
+        uint16_t get_interval(const uint8_t stream_idx) const noexcept {
+
+            return (stream_idx < STREAMS_COUNT) ? m_streams[stream_idx].interval : 0;
+        }
+
+    private:
+
+        struct Stream {
+
+            DETECTOR* detector {nullptr};
+            uint16_t max_interval {1};
+            uint16_t interval {1};
+            uint16_t frames_count {};
+            uint8_t quiet_count {};
+        };
+
+        const uint8_t m_quiet_detections;
+        Stream m_streams[STREAMS_COUNT] {};
+};
+
+}  // namespace mdetect
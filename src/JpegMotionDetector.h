@@ -3,10 +3,14 @@
 #include <stdint.h>
 #include <sys/types.h>
 #include <algorithm>
+#include <cstring>
 
 #include "mdjpeg.h"
 
 #include "CoreMotionDetector.h"
+#include "Image.h"
+#include "StreamingBlockWriter.h"
+#include "transform.h"
 
 
 namespace mdetect {
@@ -19,16 +23,43 @@ namespace mdetect {
 ///                           minimum distance separating distinct submasks, as
 ///                           well as the padding around them.
 /// \tparam MAX_BBOXES_COUNT  The maximum number of bounding boxes to store.
+/// \tparam DIFF_FRAMES_COUNT Number of consecutive frames compared with each
+///                           other. \c 2 compares each frame with a reference
+///                           frame. More than that enables multi-frame
+///                           differencing (see detect()).
 ///
-/// Uses a fixed-size internal frame buffer for storing a reference frame.
+/// Uses a fixed-size internal frame buffer for storing a reference frame or,
+/// in multi-frame mode, a ring of `DIFF_FRAMES_COUNT` frame buffers for the
+/// last frames decoded.
 template<uint16_t FRAME_WIDTH,
          uint16_t FRAME_HEIGHT,
          uint8_t GRANULARITY = 1 + std::min(FRAME_WIDTH, FRAME_HEIGHT) / 8,
-         uint8_t MAX_BBOXES_COUNT = 5>
+         uint8_t MAX_BBOXES_COUNT = 5,
+         uint8_t DIFF_FRAMES_COUNT = 2>
 class JpegMotionDetector : public CoreMotionDetector<MAX_BBOXES_COUNT> {
 
+    static_assert(DIFF_FRAMES_COUNT >= 2, "at least two frames are needed for differencing");
+
     public:
 
+        /// \brief Width (and height) in pixels of the tiles frames are divided into for adaptive thresholds and activity masking.
+        static constexpr uint8_t TILE_SIZE = 8;
+
+        /// \brief Number of tiles across the frame (the last ones may be partial).
+        static constexpr uint16_t TILE_COLS = (FRAME_WIDTH + TILE_SIZE - 1) / TILE_SIZE;
+
+        /// \brief Number of tiles down the frame (the last ones may be partial).
+        static constexpr uint16_t TILE_ROWS = (FRAME_HEIGHT + TILE_SIZE - 1) / TILE_SIZE;
+
+        /// \brief Number of tiles in the frame, i.e. the size of tile masks in bytes.
+        static constexpr uint32_t TILES_COUNT = TILE_COLS * TILE_ROWS;
+
+        /// \brief Value returned by detect() if decompressing the image fails.
+        static constexpr int DECODE_FAILED = -1;
+
+        /// \brief Value returned by detect() for an image classified as a global change in illumination.
+        static constexpr int GLOBAL_CHANGE = -2;
+
         /// \param decoder  An mdjpeg::JpegDecoder instance to use for decompressing images.
         ///
         /// Decoder instance injected here is used by set_reference() and detect().
@@ -47,9 +78,188 @@ class JpegMotionDetector : public CoreMotionDetector<MAX_BBOXES_COUNT> {
         ///
         /// The last frame processed remains assigned to injected decoder until
         /// the next call to set_reference() or detect().
+        ///
+        /// In multi-frame mode, all the frames in rotation are reset to this
+        /// one.
         bool set_reference(const uint8_t* const ref_buff, const size_t size) noexcept {
 
-            return decode_jpeg(m_ref_raw_buff, ref_buff, size);
+            if (!decode_jpeg(frame(0), ref_buff, size)) {
+
+                return false;
+            }
+
+            reset_frames();
+
+            return true;
+        }
+
+        /// \brief Sets the size of noise to be removed from movements mask.
+        ///
+        /// \param noise_removal  Size of the structuring element for
+        ///                       morphological opening of the movements mask
+        ///                       prior to dilation. \c 0 (default) or \c 1
+        ///                       disables noise removal.
+        ///
+        /// Isolated changes smaller than `noise_removal` x `noise_removal`
+        /// pixels (e.g. sensor noise in night footage) are removed instead of
+        /// being dilated into separate movements. Values of \c 2 or \c 3 are
+        /// normally enough.
+        void set_noise_removal(const uint8_t noise_removal) noexcept {
+
+            m_params.noise_removal = noise_removal;
+        }
+
+        /// \brief Sets the criteria for merging bounding boxes of detected movements.
+        ///
+        /// \param merge_distance     Bounding boxes closer to each other than
+        ///                           that (in pixels, along both axes) are
+        ///                           merged. \c 0 disables merging by distance.
+        /// \param merge_iou_percent  Bounding boxes overlapping with an
+        ///                           intersection over union (in percent) of
+        ///                           at least that are merged. \c 0 disables
+        ///                           merging by overlap.
+        ///
+        /// Disabled by default. Merging touching and overlapping bounding
+        /// boxes (`merge_distance` of \c 1) saves decoding any area twice.
+        /// Note that with merging enabled, bounding boxes are ranked by area,
+        /// i.e. get_bounding_box() returns the largest ones first rather than
+        /// following scan order. See CoreMotionDetector::detect() for
+        /// details.
+        void set_bbox_merging(const uint8_t merge_distance, const uint8_t merge_iou_percent) noexcept {
+
+            m_params.merge_distance = merge_distance;
+            m_params.merge_iou_percent = merge_iou_percent;
+        }
+
+        /// \brief Sets the limits for classifying a frame as a global change in illumination.
+        ///
+        /// \param mean_diff_limit        Mean absolute difference (with
+        ///                               respect to reference frame) at or
+        ///                               above which the change is considered
+        ///                               global. \c 0 disables the check.
+        /// \param changed_percent_limit  Percentage of pixels changed by more
+        ///                               than `threshold` at or above which
+        ///                               the change is considered global.
+        ///                               \c 0 disables the check.
+        /// \param auto_reset             Whether to reset the reference frame
+        ///                               to the frame classified as a global
+        ///                               change.
+        ///
+        /// Disabled by default, i.e. every frame is labeled however much of
+        /// it changed (as a frame-sized bounding box if all of it did). A
+        /// `changed_percent_limit` of \c 50 suits most scenes. See
+        /// CoreMotionDetector::detect() for details.
+        void set_global_change_limits(const uint8_t mean_diff_limit,
+                                      const uint8_t changed_percent_limit,
+                                      const bool auto_reset = false) noexcept {
+
+            m_params.mean_diff_limit = mean_diff_limit;
+            m_params.changed_percent_limit = changed_percent_limit;
+            m_auto_reset = auto_reset;
+        }
+
+        /// \brief Enables thresholds adapted to the noise level estimated in each tile of the frame.
+        ///
+        /// \param noise_gain     Per-tile threshold as a multiple of the noise
+        ///                       level estimated in the tile. \c 0 (default)
+        ///                       disables adaptive thresholds.
+        /// \param min_threshold  Lower limit on per-tile thresholds.
+        /// \param max_threshold  Upper limit on per-tile thresholds.
+        ///
+        /// The noise level in each tile (of `TILE_SIZE` x `TILE_SIZE` pixels)
+        /// is estimated as a moving average (over about 16 frames) of its mean
+        /// absolute difference with respect to reference frame. Estimates may
+        /// only double from one frame to the next, so that movements passing
+        /// through a tile do not inflate them much. Thresholds for each frame
+        /// are looked up from the estimates as of the previous frames, in a
+        /// table built here. Frames classified as global changes are not
+        /// taken into account.
+        ///
+        /// Until the estimates are available (i.e. for the first frame after
+        /// enabling), the `threshold` passed to detect() is used throughout.
+        /// Afterwards, it is ignored. Values of \c 3 to \c 5 for
+        /// `noise_gain` suit mostly static scenes.
+        void set_adaptive_threshold(const uint8_t noise_gain,
+                                    const uint8_t min_threshold = 15,
+                                    const uint8_t max_threshold = 127) noexcept {
+
+            m_is_adaptive_threshold = noise_gain;
+            m_is_noise_estimated = false;
+
+            for (uint noise_level = 0; noise_level < 256; ++noise_level) {
+
+                m_threshold_lut[noise_level] = std::min<uint>(std::max<uint>(noise_level * noise_gain, min_threshold), max_threshold);
+            }
+        }
+
+        /// \brief Enables automatic masking of the tiles which are active most of the time.
+        ///
+        /// \param activity_percent  Percentage of frames with changes in a
+        ///                          tile at or above which the tile is
+        ///                          masked, i.e. left out of detection.
+        ///                          \c 0 (default) disables activity
+        ///                          tracking, leaving the mask as it is.
+        /// \param recheck_interval  Number of frames between rechecks of the
+        ///                          tiles masked.
+        /// \param decay_shift       Activity is tracked over about
+        ///                          `2^decay_shift` frames.
+        ///
+        /// Scenes often have regions which change all the time (flags, trees,
+        /// screens, water...) and would otherwise be reported as movements on
+        /// every frame. Activity of each tile (of `TILE_SIZE` x `TILE_SIZE`
+        /// pixels) is tracked as an exponentially decaying fraction of frames
+        /// with any pixels of the tile changed, as counted from the movements
+        /// mask prior to noise removal and dilation. A tile is masked as soon
+        /// as its activity reaches `activity_percent` (\c 100 meaning changes on
+        /// practically every frame of late). Changes in masked tiles
+        /// keep being counted, and every `recheck_interval` frames the masked
+        /// tiles whose activity has since dropped below `activity_percent` are
+        /// unmasked again. Frames classified as global changes are not taken
+        /// into account.
+        ///
+        /// The mask can be inspected and persisted with get_tile_mask() and
+        /// restored with set_tile_mask().
+        void set_activity_masking(const uint8_t activity_percent,
+                                  const uint16_t recheck_interval = 256,
+                                  const uint8_t decay_shift = 8) noexcept {
+
+            m_activity_percent = std::min<uint8_t>(activity_percent, 100);
+            m_recheck_interval = std::max<uint16_t>(recheck_interval, 1);
+            m_decay_shift = std::min<uint8_t>(decay_shift, 15);
+            m_frames_since_recheck = 0;
+        }
+
+        /// \brief Retrieves the mask of tiles left out of detection.
+        ///
+        /// \param tile_mask  Buffer of `TILES_COUNT` bytes to copy the mask
+        ///                   into, row of tiles by row of tiles. Non-zero
+        ///                   values mark the tiles masked.
+        void get_tile_mask(uint8_t* const tile_mask) const noexcept {
+
+            std::memcpy(tile_mask, m_tile_skip_mask, TILES_COUNT);
+        }
+
+        /// \brief Sets the mask of tiles left out of detection.
+        ///
+        /// \param tile_mask  Buffer of `TILES_COUNT` bytes laid out as by
+        ///                   get_tile_mask(), e.g. one persisted earlier or
+        ///                   drawn by hand.
+        ///
+        /// Works with activity masking disabled as well, as a static mask.
+        /// With it enabled, the tiles masked here start off as fully active,
+        /// so they stay masked until they calm down for a while.
+        void set_tile_mask(const uint8_t* const tile_mask) noexcept {
+
+            m_is_tile_mask_set = false;
+
+            for (uint32_t tile_idx = 0; tile_idx < TILES_COUNT; ++tile_idx) {
+
+                m_tile_skip_mask[tile_idx] = tile_mask[tile_idx] ? 1 : 0;
+                m_tile_activity[tile_idx] = tile_mask[tile_idx] ? FULL_ACTIVITY : 0;
+                m_is_tile_mask_set |= tile_mask[tile_idx] != 0;
+            }
+
+            m_frames_since_recheck = 0;
         }
 
         /// \brief Customization of CoreMotionDetector::detect().
@@ -58,29 +268,60 @@ class JpegMotionDetector : public CoreMotionDetector<MAX_BBOXES_COUNT> {
         ///                    the image to detect motion in (with respect to
         ///                    reference frame).
         /// \param size        Size of the memory block in bytes.
-        /// \param threshold   Minimum absolute value for a change in pixel
-        ///                    intensity (with respect to reference frame) to be
-        ///                    considered as due to movement.
-        /// \return            Total count of movement regions detected. If
-        ///                    decompressing the image was not successful,
-        ///                    returns \c -1.
+        /// \param threshold         Minimum absolute value for a change in pixel
+        ///                          intensity (with respect to reference frame)
+        ///                          to be considered as due to movement.
+        /// \param update_reference  Whether to replace the reference frame
+        ///                          with this one (unless decompressing it
+        ///                          fails). Ignored in multi-frame mode.
+        /// \return                  Total count of movement regions detected. If
+        ///                          decompressing the image was not successful,
+        ///                          returns \c DECODE_FAILED. If the image was
+        ///                          classified as a global change in illumination
+        ///                          (see set_global_change_limits()), returns
+        ///                          \c GLOBAL_CHANGE.
         ///
         /// Manages JPEG decompression of the input image and all the buffer
         /// requirements of CoreMotionDetector::detect() by creating them on its
         /// own stack. Memory is reused as much as possible. The last frame
         /// processed remains assigned to injected decoder until the next call
         /// to set_reference() or detect().
-        int detect(const uint8_t* const frame_buff, const size_t size, const uint8_t threshold = 127) noexcept {
+        ///
+        /// Updating the reference frame here costs a copy of the frame rather
+        /// than decoding it once more with set_reference(): the reference
+        /// frame is not needed past the absolute difference, so the movements
+        /// mask is processed in its place, leaving the image intact.
+        ///
+        /// If automatic reset on global changes is enabled (and the reference
+        /// frame is not updated anyway), the image classified as such is
+        /// decoded once more, this time as the new reference frame (the
+        /// internal scratchpad does not retain it).
+        ///
+        /// \par Multi-frame mode
+        /// With `DIFF_FRAMES_COUNT` greater than \c 2, each frame is decoded
+        /// into the ring of the last frames (in place of the oldest one) and
+        /// compared with each of the previous `DIFF_FRAMES_COUNT - 1` frames.
+        /// Only the changes with respect to all of them are kept, so moving
+        /// objects are reported at their current position only, rather than
+        /// at both the old and the new one (see CoreMotionDetector::detect()).
+        /// The ring advances on every frame decoded, there is no need to call
+        /// set_reference() after detect(). A frame classified as a global
+        /// change is kept in rotation as well, automatic reset sets all the
+        /// frames to it without decoding it again.
+        int detect(const uint8_t* const frame_buff,
+                   const size_t size,
+                   const uint8_t threshold = 127,
+                   const bool update_reference = false) noexcept {
 
             // NOTE:
             //  - at one point, "content" of `scratchpad1` will be dilated into `scratchpad2`
-            //  - dilation operations *cannot* be done in place
             //  - the pointers would, normally, point to two separate, non-overlapping buffers
             //  - however, in this implementation the two buffers overlap(!) by design
+            //  - dilation allows that as long as `scratchpad2` does not start after `scratchpad1`
             //  - this approach uses less memory and in a more cache friendly manner
 
-            // to prevent read-write aliasing, set the smallest required pointer offset for
-            // the greatest allowable buffer overlap
+            // offset `scratchpad2` by a granularity-proportional amount of rows, which leaves the
+            // tail of `scratchpad1` free for storing bounding boxes once it is dilated
             constexpr uint offset = FRAME_WIDTH * (GRANULARITY / 2 + 1);
 
             // set the size for the single, joint buffer and allocate it on the stack
@@ -90,33 +331,188 @@ class JpegMotionDetector : public CoreMotionDetector<MAX_BBOXES_COUNT> {
             // set the starting points to overlapping memory blocks within the joint buffer
 
             // `scratchpad1` is used for:
-            //  1) current frame pixel data
+            //  1) current frame pixel data (unless decoded into the ring in multi-frame mode)
             //  2) element-wise absolute difference of 1) and reference frame pixel data
             //  3) in place thresholded 2)
+            //  4) in place noise removal from 3) (optional)
             uint8_t* const scratchpad1 = &joint_buffer[offset];
 
-            // `scratchpad2` is used for dilated 3)
+            // `scratchpad2` is used for dilated 4)
             uint8_t* const scratchpad2 = &joint_buffer[0];
 
             // `scratchpad3` is used for boxed connected components algorithm
             uint8_t* const scratchpad3 = &joint_buffer[FRAME_WIDTH * FRAME_HEIGHT];
 
-            if (!decode_jpeg(scratchpad1, frame_buff, size)) {
+            // when updating the reference frame, 2) to 4) and the dilation are done in place of it
+            // instead, leaving 1) intact and the head of the joint buffer (ahead of `scratchpad1`)
+            // free for boxed connected components algorithm
+            const bool is_reference_updated = !IS_MULTI_FRAME && update_reference;
+
+            // per-tile thresholds and statistics, used only if adaptive thresholds are enabled
+            uint8_t tile_thresholds[TILES_COUNT];
+            uint32_t tile_diff_sums[TILES_COUNT];
+
+            // per-tile counts of changed pixels, used only if activity masking is enabled
+            uint16_t tile_changed_counts[TILES_COUNT];
+
+            DetectionParams params = m_params;
+            params.threshold = threshold;
+
+            TileBuffers tiles;
+            tiles.tile_size = TILE_SIZE;
+            tiles.thresholds = get_tile_thresholds(tile_thresholds, threshold);
+            tiles.diff_sums = m_is_adaptive_threshold ? tile_diff_sums : nullptr;
+            tiles.skip_mask = get_tile_skip_mask();
+            tiles.changed_counts = m_activity_percent ? tile_changed_counts : nullptr;
 
-                return -1;
+            // in multi-frame mode, the current frame takes the place of the oldest one in the ring
+            uint8_t* const curr_frame = IS_MULTI_FRAME ? frame(STORED_FRAMES_COUNT - 1) : scratchpad1;
+
+            if (!decode_jpeg(curr_frame, frame_buff, size)) {
+
+                return DECODE_FAILED;
+            }
+
+            // frames preceding the reference one (i.e. the previous frame in multi-frame mode), newest first
+            uint8_t* older_frames[STORED_FRAMES_COUNT] {};
+            for (uint8_t age = 1; age + 1 < STORED_FRAMES_COUNT; ++age) {
+
+                older_frames[age - 1] = frame(age);
             }
 
             // the `CoreMotionDetector::detect` is oblivious to the overlap
-            return CoreMotionDetector<MAX_BBOXES_COUNT>::detect(m_ref_raw_buff,
-                                                                scratchpad1,
-                                                                scratchpad1,
-                                                                scratchpad2,
-                                                                scratchpad3,
-                                                                offset,
-                                                                FRAME_WIDTH,
-                                                                FRAME_HEIGHT,
-                                                                threshold,
-                                                                GRANULARITY);
+            const uint movements_count = CoreMotionDetector<MAX_BBOXES_COUNT>::detect(curr_frame,
+                                                                                      frame(0),
+                                                                                      older_frames,
+                                                                                      IS_MULTI_FRAME ? STORED_FRAMES_COUNT - 2 : 0,
+                                                                                      is_reference_updated ? frame(0) : scratchpad1,
+                                                                                      is_reference_updated ? frame(0) : scratchpad2,
+                                                                                      is_reference_updated ? scratchpad2 : scratchpad3,
+                                                                                      offset,
+                                                                                      FRAME_WIDTH,
+                                                                                      FRAME_HEIGHT,
+                                                                                      params,
+                                                                                      tiles);
+
+            if constexpr (IS_MULTI_FRAME) {
+
+                m_newest_frame_idx = (m_newest_frame_idx + 1) % STORED_FRAMES_COUNT;
+            }
+
+            if (is_reference_updated) {
+
+                std::memcpy(frame(0), curr_frame, FRAME_WIDTH * FRAME_HEIGHT);
+            }
+
+            if (get_status() == DetectionStatus::global_change) {
+
+                if (m_auto_reset && !is_reference_updated) {
+
+                    if constexpr (IS_MULTI_FRAME) {
+
+                        reset_frames();
+                    }
+
+                    else {
+
+                        decode_jpeg(frame(0), frame_buff, size);
+                    }
+                }
+
+                return GLOBAL_CHANGE;
+            }
+
+            if (m_is_adaptive_threshold) {
+
+                update_noise_estimates(tile_diff_sums);
+            }
+
+            if (m_activity_percent) {
+
+                update_tile_activity(tile_changed_counts);
+            }
+
+            return movements_count;
+        }
+
+        /// \brief Streaming alternative to detect() with a fraction of its memory footprint.
+        ///
+        /// \tparam BAND_ROWS         Number of rows accumulated by the block
+        ///                           writer at the same time (see
+        ///                           StreamingBlockWriter for choosing it).
+        /// \param frame_buff        Same as for detect().
+        /// \param size              Same as for detect().
+        /// \param threshold         Same as for detect().
+        /// \param update_reference  Whether to replace the reference frame
+        ///                          with this one, row by row as it is
+        ///                          processed.
+        /// \return                  Same as for detect(). Returns \c DECODE_FAILED also
+        ///                          if `BAND_ROWS` is too few for the image.
+        ///
+        /// Instead of decoding the whole frame first, rows of the frame are
+        /// compared against the reference frame as soon as the decoder outputs
+        /// the MCU rows covering them (see StreamingBlockWriter). Rows of the
+        /// movements mask are thresholded, dilated and labeled incrementally,
+        /// so the frame is never stored in full and the result is ready as
+        /// soon as its last MCU row is decoded. Apart from the bounding box
+        /// buffer, scratch memory is limited to a few rows: about
+        /// `FRAME_WIDTH * (6 * BAND_ROWS + GRANULARITY / 2 + 9)` bytes of stack
+        /// in total (plus 5 bytes per tile for adaptive thresholds and 2 for
+        /// activity masking), as opposed to over `FRAME_WIDTH * FRAME_HEIGHT` bytes used
+        /// by detect().
+        ///
+        /// A global change is detected as soon as the limits are exceeded by
+        /// the rows processed so far, labeling stops there. Updating the
+        /// reference in place saves decoding the frame once more with
+        /// set_reference() (if decompression fails midway, the reference
+        /// frame is left partially updated).
+        ///
+        /// Detected movements are the same as those by detect() for the same
+        /// decoded pixels, except that:
+        ///  - noise removal (see set_noise_removal()) is not applied,
+        ///  - downscaled pixels are rounded averages which may differ slightly
+        ///    from those by mdjpeg::DownscalingBlockWriter or DC-only decoding.
+        ///
+        /// Note that every frame is fully decoded through the block writer,
+        /// without the DC-only shortcut for 1:8 downscaling, so memory is
+        /// saved at the expense of some CPU time. Multi-frame mode is not
+        /// supported.
+        template<uint8_t BAND_ROWS = 4>
+        int detect_streaming(const uint8_t* const frame_buff,
+                             const size_t size,
+                             const uint8_t threshold = 127,
+                             const bool update_reference = false) noexcept {
+
+            static_assert(!IS_MULTI_FRAME, "streaming detection compares with a single reference frame");
+
+            if (!m_decoder->assign(frame_buff, size)) {
+
+                return DECODE_FAILED;
+            }
+
+            StreamingDetection detection(*this, threshold, update_reference);
+            StreamingBlockWriter<FRAME_WIDTH, FRAME_HEIGHT, BAND_ROWS> streaming_block_writer(detection);
+
+            // all the output goes through the block writer, there is no destination buffer
+            if (!m_decoder->luma_decode(nullptr, {0, 0, FRAME_WIDTH, FRAME_HEIGHT}, streaming_block_writer) ||
+                !streaming_block_writer.is_complete()) {
+
+                return DECODE_FAILED;
+            }
+
+            const uint movements_count = detection.finish();
+
+            if (get_status() == DetectionStatus::global_change) {
+
+                if (m_auto_reset && !update_reference) {
+
+                    decode_jpeg(frame(0), frame_buff, size);
+                }
+
+                return GLOBAL_CHANGE;
+            }
+
+            return movements_count;
         }
 
         /// \brief Forwards to CoreMotionDetector::get_bounding_box().
@@ -125,10 +521,367 @@ class JpegMotionDetector : public CoreMotionDetector<MAX_BBOXES_COUNT> {
             return CoreMotionDetector<MAX_BBOXES_COUNT>::get_bounding_box();
         }
 
+        /// \brief Forwards to CoreMotionDetector::bboxes().
+        BoundingBoxRange bboxes() const noexcept {
+
+            return CoreMotionDetector<MAX_BBOXES_COUNT>::bboxes();
+        }
+
+        /// \brief Forwards to CoreMotionDetector::get_status().
+        DetectionStatus get_status() const noexcept {
+
+            return CoreMotionDetector<MAX_BBOXES_COUNT>::get_status();
+        }
+
+        /// \brief Forwards to CoreMotionDetector::get_result().
+        void get_result(const uint32_t frame_id, DetectionResult<MAX_BBOXES_COUNT>& result) const noexcept {
+
+            CoreMotionDetector<MAX_BBOXES_COUNT>::get_result(frame_id, result);
+        }
+
     private:
 
         mdjpeg::JpegDecoder* const m_decoder {nullptr};
-        uint8_t m_ref_raw_buff[FRAME_WIDTH * FRAME_HEIGHT] {};
+        // frames in rotation, i.e. the reference frame alone unless in multi-frame mode
+        static constexpr bool IS_MULTI_FRAME = DIFF_FRAMES_COUNT > 2;
+        static constexpr uint8_t STORED_FRAMES_COUNT = IS_MULTI_FRAME ? DIFF_FRAMES_COUNT : 1;
+
+        uint8_t m_frames[STORED_FRAMES_COUNT][FRAME_WIDTH * FRAME_HEIGHT] {};
+        uint8_t m_newest_frame_idx {};
+        bool m_auto_reset {false};
+
+        // tuning parameters for `CoreMotionDetector::detect` (the threshold is given per frame)
+        DetectionParams m_params {default_params()};
+
+        bool m_is_adaptive_threshold {false};
+        bool m_is_noise_estimated {false};
+        uint8_t m_threshold_lut[256] {};
+
+        // per-tile noise level estimates, i.e. mean absolute differences (in 1/256 units)
+        uint16_t m_tile_noise[TILES_COUNT] {};
+
+        // activity of a tile with changes on every frame, with 15 fraction bits more than
+        // the slowest decay truncates, so that activities settle within 1/65536 of either end
+        static constexpr uint32_t FULL_ACTIVITY = uint32_t{1} << 31;
+        static constexpr uint32_t ACTIVITY_RESOLUTION = FULL_ACTIVITY >> 16;
+
+        uint8_t m_activity_percent {0};
+        uint16_t m_recheck_interval {256};
+        uint8_t m_decay_shift {8};
+        uint16_t m_frames_since_recheck {};
+        bool m_is_tile_mask_set {false};
+
+        // tiles left out of detection and per-tile activities (fractions of frames changed, in 1/2^31 units)
+        uint8_t m_tile_skip_mask[TILES_COUNT] {};
+        uint32_t m_tile_activity[TILES_COUNT] {};
+
+        // row by row counterpart of `CoreMotionDetector::detect` fed by `StreamingBlockWriter`
+        class StreamingDetection final : public RowSink {
+
+            public:
+
+                StreamingDetection(JpegMotionDetector& detector, const uint8_t threshold, const bool update_reference) noexcept :
+                    m_detector(detector),
+                    m_threshold(threshold),
+                    m_update_reference(update_reference) {
+
+                    std::fill_n(m_last_changed_rows, FRAME_WIDTH, NEVER_CHANGED);
+
+                    // same capacity as given to `CoreMotionDetector::detect` by `detect`
+                    m_capacity = m_detector.set_bbox_buffer(m_bbox_buff, sizeof(m_bbox_buff));
+
+                    m_tile_thresholds = m_detector.get_tile_thresholds(m_tile_thresholds_buff, threshold);
+                    m_tile_skip_mask = m_detector.get_tile_skip_mask();
+                    m_tile_changed_counts = m_detector.m_activity_percent ? m_tile_changed_counts_buff : nullptr;
+                }
+
+                void push_row(uint8_t* const row, const uint16_t row_idx) noexcept override {
+
+                    uint8_t* const ref_row = &m_detector.frame(0)[row_idx * FRAME_WIDTH];
+
+                    const Image curr_img(row, FRAME_WIDTH, 1);
+                    const Image ref_img(ref_row, FRAME_WIDTH, 1);
+                    Image mask_img(m_mask_row, FRAME_WIDTH, 1);
+
+                    // tiles of the row (as a single-row image, it lies within the first row of tiles)
+                    const uint32_t first_tile_idx = (row_idx / TILE_SIZE) * TILE_COLS;
+
+                    if (m_tile_thresholds) {
+
+                        m_diff_sum += mdetect::transform::absdiff(mask_img, curr_img, ref_img, &m_tile_diff_sums[first_tile_idx], TILE_SIZE);
+                    }
+
+                    else {
+
+                        m_diff_sum += mdetect::transform::absdiff(mask_img, curr_img, ref_img);
+                    }
+
+                    if (m_update_reference) {
+
+                        std::memcpy(ref_row, row, FRAME_WIDTH);
+                    }
+
+                    if (m_is_global_change) {
+
+                        return;
+                    }
+
+                    m_changed_count += m_tile_thresholds ?
+                        mdetect::transform::threshold(mask_img, mask_img, &m_tile_thresholds[first_tile_idx], TILE_SIZE) :
+                        mdetect::transform::threshold(mask_img, mask_img, m_threshold);
+
+                    // partial sums only grow, limits reached by now are reached by the whole frame
+                    if (is_limit_reached()) {
+
+                        m_is_global_change = true;
+
+                        return;
+                    }
+
+                    if (m_tile_skip_mask || m_tile_changed_counts) {
+
+                        mdetect::transform::mask_tiles(mask_img,
+                                                       m_tile_skip_mask ? &m_tile_skip_mask[first_tile_idx] : nullptr,
+                                                       m_tile_changed_counts ? &m_tile_changed_counts[first_tile_idx] : nullptr,
+                                                       TILE_SIZE);
+                    }
+
+                    // vertical part of the dilation: keep track of the last row changed in each column
+                    for (uint16_t col = 0; col < FRAME_WIDTH; ++col) {
+
+                        if (m_mask_row[col]) {
+
+                            m_last_changed_rows[col] = row_idx;
+                        }
+                    }
+
+                    // the dilated row `REACH_AHEAD` rows above is complete now
+                    if (row_idx >= REACH_AHEAD) {
+
+                        label_dilated_row(m_next_dilated_row++);
+                    }
+                }
+
+                // labels the remaining rows and stores bounding boxes, returns their count
+                uint finish() noexcept {
+
+                    m_detector.m_diff_sum = m_diff_sum;
+                    m_detector.m_changed_count = m_changed_count;
+                    m_detector.m_pixels_count = FRAME_WIDTH * FRAME_HEIGHT;
+
+                    if (m_is_global_change) {
+
+                        return m_detector.abort_on_global_change();
+                    }
+
+                    while (m_next_dilated_row < FRAME_HEIGHT) {
+
+                        label_dilated_row(m_next_dilated_row++);
+                    }
+
+                    m_detector.m_status = DetectionStatus::ok;
+
+                    if (m_tile_thresholds) {
+
+                        m_detector.update_noise_estimates(m_tile_diff_sums);
+                    }
+
+                    if (m_tile_changed_counts) {
+
+                        m_detector.update_tile_activity(m_tile_changed_counts);
+                    }
+
+                    return m_detector.store_labeled_bboxes(m_next_label,
+                                                           FRAME_WIDTH,
+                                                           FRAME_HEIGHT,
+                                                           m_detector.m_params.merge_distance,
+                                                           m_detector.m_params.merge_iou_percent);
+                }
+
+            private:
+
+                // same window as `transform::dilate` uses along each axis
+                static constexpr uint8_t REACH_BACK = GRANULARITY / 2;
+                static constexpr uint8_t REACH_AHEAD = GRANULARITY - 1 - GRANULARITY / 2;
+                static constexpr int32_t NEVER_CHANGED = -2 * GRANULARITY;
+
+                JpegMotionDetector& m_detector;
+                const uint8_t m_threshold;
+                const bool m_update_reference;
+
+                uint64_t m_diff_sum {};
+                uint64_t m_changed_count {};
+                bool m_is_global_change {false};
+                uint16_t m_next_dilated_row {};
+                uint m_capacity {};
+
+                // labeling of areas with detected "movements" starts with 1
+                uint m_next_label {1};
+
+                uint8_t m_mask_row[FRAME_WIDTH] {};
+                int32_t m_last_changed_rows[FRAME_WIDTH] {};
+                uint8_t m_label_rows[2][FRAME_WIDTH] {};
+                uint8_t m_bbox_buff[FRAME_WIDTH * (GRANULARITY / 2 + 1)] {};
+
+                // per-tile thresholds and statistics, used only if adaptive thresholds are enabled
+                const uint8_t* m_tile_thresholds {nullptr};
+                uint8_t m_tile_thresholds_buff[TILES_COUNT] {};
+                uint32_t m_tile_diff_sums[TILES_COUNT] {};
+
+                // tiles masked and per-tile counts of changes, used only if activity masking is enabled or a mask is set
+                const uint8_t* m_tile_skip_mask {nullptr};
+                uint16_t* m_tile_changed_counts {nullptr};
+                uint16_t m_tile_changed_counts_buff[TILES_COUNT] {};
+
+                bool is_limit_reached() const noexcept {
+
+                    const uint64_t pixels_count = FRAME_WIDTH * FRAME_HEIGHT;
+
+                    const DetectionParams& params = m_detector.m_params;
+
+                    return (params.mean_diff_limit && m_diff_sum >= params.mean_diff_limit * pixels_count) ||
+                           (params.changed_percent_limit && 100 * m_changed_count >= params.changed_percent_limit * pixels_count);
+                }
+
+                // completes the dilation of a row horizontally and labels it
+                void label_dilated_row(const uint16_t row) noexcept {
+
+                    if (m_next_label >= m_capacity) {
+
+                        return;
+                    }
+
+                    uint8_t* const row_labels = m_label_rows[row % 2];
+
+                    for (uint16_t col = 0; col < FRAME_WIDTH; ++col) {
+
+                        row_labels[col] = (m_last_changed_rows[col] + REACH_BACK >= row) ? 255 : 0;
+                    }
+
+                    // a single row has nothing to dilate vertically
+                    Image row_img(row_labels, FRAME_WIDTH, 1);
+                    mdetect::transform::dilate(row_img, row_img, GRANULARITY);
+
+                    m_detector.label_row(row_labels, row ? m_label_rows[(row - 1) % 2] : nullptr, row, FRAME_WIDTH, m_next_label, m_capacity);
+                }
+        };
+
+        // fills in per-tile thresholds for the current frame, returns `nullptr` if adaptive thresholds are disabled
+        const uint8_t* get_tile_thresholds(uint8_t* const tile_thresholds, const uint8_t threshold) const noexcept {
+
+            if (!m_is_adaptive_threshold) {
+
+                return nullptr;
+            }
+
+            for (uint32_t tile_idx = 0; tile_idx < TILES_COUNT; ++tile_idx) {
+
+                tile_thresholds[tile_idx] = m_is_noise_estimated ?
+                    m_threshold_lut[std::min((m_tile_noise[tile_idx] + 128) >> 8, 255)] :
+                    threshold;
+            }
+
+            return tile_thresholds;
+        }
+
+        // updates per-tile noise level estimates from per-tile sums of absolute differences of the current frame
+        void update_noise_estimates(const uint32_t* const tile_diff_sums) noexcept {
+
+            for (uint16_t tile_row = 0; tile_row < TILE_ROWS; ++tile_row) {
+
+                const uint32_t tile_height = std::min<uint32_t>(TILE_SIZE, FRAME_HEIGHT - tile_row * TILE_SIZE);
+
+                for (uint16_t tile_col = 0; tile_col < TILE_COLS; ++tile_col) {
+
+                    const uint32_t tile_width = std::min<uint32_t>(TILE_SIZE, FRAME_WIDTH - tile_col * TILE_SIZE);
+                    const uint32_t tile_idx = tile_row * TILE_COLS + tile_col;
+
+                    uint32_t mean_diff = (static_cast<uint64_t>(tile_diff_sums[tile_idx]) << 8) / (tile_width * tile_height);
+                    uint16_t& noise = m_tile_noise[tile_idx];
+
+                    if (!m_is_noise_estimated) {
+
+                        noise = mean_diff;
+
+                        continue;
+                    }
+
+                    // movements inflate the mean difference, let the estimate grow only gradually
+                    mean_diff = std::min<uint32_t>(mean_diff, 2 * noise + 2 * 256);
+
+                    noise = (15 * noise + mean_diff + 8) / 16;
+                }
+            }
+
+            m_is_noise_estimated = true;
+        }
+
+        static constexpr DetectionParams default_params() noexcept {
+
+            DetectionParams params;
+            params.granularity = GRANULARITY;
+
+            return params;
+        }
+
+        // returns the tile mask if there is anything to mask, `nullptr` otherwise
+        const uint8_t* get_tile_skip_mask() const noexcept {
+
+            return (m_activity_percent || m_is_tile_mask_set) ? m_tile_skip_mask : nullptr;
+        }
+
+        // updates per-tile activities from per-tile counts of changed pixels, (un)masking tiles accordingly
+        void update_tile_activity(const uint16_t* const tile_changed_counts) noexcept {
+
+            // 100 % is reachable as activity settles just short of full
+            const uint32_t activity_limit = std::min<uint64_t>(uint64_t{m_activity_percent} * FULL_ACTIVITY / 100,
+                                                               FULL_ACTIVITY - ACTIVITY_RESOLUTION);
+            const bool is_recheck_due = ++m_frames_since_recheck >= m_recheck_interval;
+
+            if (is_recheck_due) {
+
+                m_frames_since_recheck = 0;
+            }
+
+            m_is_tile_mask_set = false;
+
+            for (uint32_t tile_idx = 0; tile_idx < TILES_COUNT; ++tile_idx) {
+
+                uint32_t& activity = m_tile_activity[tile_idx];
+                const int64_t target = tile_changed_counts[tile_idx] ? FULL_ACTIVITY : 0;
+
+                // truncation leaves it less than `2^m_decay_shift`, i.e. at most `ACTIVITY_RESOLUTION`, off the target
+                activity += (target - activity) / (int64_t{1} << m_decay_shift);
+
+                // masking is immediate, unmasking waits for a recheck
+                if (activity >= activity_limit) {
+
+                    m_tile_skip_mask[tile_idx] = 1;
+                }
+
+                else if (is_recheck_due) {
+
+                    m_tile_skip_mask[tile_idx] = 0;
+                }
+
+                m_is_tile_mask_set |= m_tile_skip_mask[tile_idx] != 0;
+            }
+        }
+
+        // frame in rotation by age, \c 0 being the newest one (the reference frame)
+        uint8_t* frame(const uint8_t age) noexcept {
+
+            return m_frames[(m_newest_frame_idx + STORED_FRAMES_COUNT - age) % STORED_FRAMES_COUNT];
+        }
+
+        // sets all the frames in rotation to the newest one
+        void reset_frames() noexcept {
+
+            for (uint8_t age = 1; age < STORED_FRAMES_COUNT; ++age) {
+
+                std::memcpy(frame(age), frame(0), FRAME_WIDTH * FRAME_HEIGHT);
+            }
+        }
 
         // decompresses a JPEG image with downscaling if necessary
         bool decode_jpeg(uint8_t* const raw_buff, const uint8_t* const jpeg_buff, const size_t size) noexcept {
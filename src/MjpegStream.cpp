@@ -0,0 +1,241 @@
+#include "MjpegStream.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstring>
+
+
+using namespace mdetect;
+
+namespace {
+
+// JPEG marker codes (following the 0xFF prefix) relevant for frame boundaries
+constexpr uint8_t SOI = 0xD8;
+constexpr uint8_t EOI = 0xD9;
+constexpr uint8_t SOS = 0xDA;
+constexpr uint8_t RST0 = 0xD0;
+constexpr uint8_t RST7 = 0xD7;
+constexpr uint8_t TEM = 0x01;
+
+// finds the next 0xFF byte, returns `end` if there is none
+const uint8_t* find_prefix(const uint8_t* const begin, const uint8_t* const end) noexcept {
+
+    if (begin >= end) {
+
+        return end;
+    }
+
+    const void* const found = std::memchr(begin, 0xFF, end - begin);
+
+    return found ? static_cast<const uint8_t*>(found) : end;
+}
+
+}  // namespace
+
+const uint8_t* mjpeg::find_frame(const uint8_t* const begin, const uint8_t* const end, JpegFrame& frame) noexcept {
+
+    frame = {};
+
+    const uint8_t* soi = find_prefix(begin, end);
+
+    while (soi < end) {
+
+        // a lone 0xFF at the very end may be the first half of an SOI marker
+        if (soi + 1 == end) {
+
+            return soi;
+        }
+
+        if (soi[1] != SOI) {
+
+            soi = find_prefix(soi + 1, end);
+
+            continue;
+        }
+
+        // walk the marker segments of the frame starting right after the SOI marker
+        const uint8_t* pos = soi + 2;
+
+        while (true) {
+
+            if (pos >= end) {
+
+                return soi;
+            }
+
+            if (*pos != 0xFF) {
+
+                break;
+            }
+
+            // skip the prefix along with any fill bytes
+            while (pos < end && *pos == 0xFF) {
+
+                ++pos;
+            }
+
+            if (pos == end) {
+
+                return soi;
+            }
+
+            const uint8_t marker = *pos++;
+
+            if (marker == EOI) {
+
+                frame = {soi, static_cast<size_t>(pos - soi)};
+
+                return pos;
+            }
+
+            // an SOI marker within a frame means the frame is truncated
+            if (marker == SOI) {
+
+                break;
+            }
+
+            // standalone markers have no length field
+            if (marker == TEM || (marker >= RST0 && marker <= RST7)) {
+
+                continue;
+            }
+
+            if (end - pos < 2) {
+
+                return soi;
+            }
+
+            const uint16_t length = (pos[0] << 8) | pos[1];
+
+            if (length < 2) {
+
+                break;
+            }
+
+            if (static_cast<size_t>(end - pos) < length) {
+
+                return soi;
+            }
+
+            pos += length;
+
+            if (marker != SOS) {
+
+                continue;
+            }
+
+            // scan entropy-coded data for the next marker that is neither a
+            // stuffed 0xFF byte nor a restart marker
+            while (true) {
+
+                pos = find_prefix(pos, end);
+
+                if (end - pos < 2) {
+
+                    return soi;
+                }
+
+                const uint8_t next = pos[1];
+
+                if (next == 0x00 || (next >= RST0 && next <= RST7)) {
+
+                    pos += 2;
+                }
+
+                else if (next == 0xFF) {
+
+                    ++pos;
+                }
+
+                else {
+
+                    break;
+                }
+            }
+        }
+
+        // the frame is corrupted, resynchronize on the next SOI marker
+        soi = find_prefix(soi + 2, end);
+    }
+
+    return end;
+}
+
+MappedMjpegStream::~MappedMjpegStream() {
+
+    close();
+}
+
+bool MappedMjpegStream::open(const char* const path) noexcept {
+
+    close();
+
+    const int fd = ::open(path, O_RDONLY);
+
+    if (fd < 0) {
+
+        return false;
+    }
+
+    struct stat file_stat {};
+
+    if (::fstat(fd, &file_stat) || file_stat.st_size <= 0) {
+
+        ::close(fd);
+
+        return false;
+    }
+
+    const size_t size = file_stat.st_size;
+    void* const mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    // the mapping remains valid after closing its file descriptor
+    ::close(fd);
+
+    if (mapping == MAP_FAILED) {
+
+        return false;
+    }
+
+    // frames are read front to back, let the kernel read ahead aggressively
+    ::madvise(mapping, size, MADV_SEQUENTIAL);
+
+    m_data = static_cast<const uint8_t*>(mapping);
+    m_size = size;
+    m_cursor = m_data;
+
+    return true;
+}
+
+void MappedMjpegStream::close() noexcept {
+
+    if (m_data) {
+
+        ::munmap(const_cast<uint8_t*>(m_data), m_size);
+    }
+
+    m_data = nullptr;
+    m_size = 0;
+    m_cursor = nullptr;
+}
+
+JpegFrame MappedMjpegStream::next_frame() noexcept {
+
+    JpegFrame frame;
+
+    if (m_data) {
+
+        m_cursor = mjpeg::find_frame(m_cursor, m_data + m_size, frame);
+    }
+
+    return frame;
+}
+
+void MappedMjpegStream::rewind() noexcept {
+
+    m_cursor = m_data;
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+
+namespace mdetect {
+
+/// \brief Non-owning view of a single JFIF-compressed frame.
+///
+/// Points into memory owned by the stream the frame was obtained from. Can be
+/// passed as-is to JpegMotionDetector::set_reference() or
+/// JpegMotionDetector::detect().
+struct JpegFrame {
+
+    const uint8_t* data {nullptr};
+    size_t size {};
+
+    /// \brief Checks whether the view points to a frame.
+    explicit operator bool() const noexcept {
+
+        return data;
+    }
+};
+
+/// \brief Stateless MJPEG stream parsing functions that don't need a class.
+namespace mjpeg {
+
+/// \brief Finds the first complete JPEG frame (SOI..EOI) within a memory block.
+///
+/// \param begin  Pointer to the first byte of the memory block.
+/// \param end    Pointer past the last byte of the memory block.
+/// \param frame  View to set to the frame found. Set to an empty view if no
+///               complete frame is found.
+/// \return       Pointer past the EOI marker of the frame found. If no
+///               complete frame is found, pointer to the first byte which may
+///               still be a part of a frame (i.e. the SOI marker of a
+///               truncated frame), or \c end if there is no such byte.
+///
+/// Works for plain concatenated JPEG frames as well as for multipart streams
+/// since anything between an EOI and the next SOI marker is skipped. Marker
+/// segments are skipped by their length fields (which skips over embedded
+/// thumbnails) and entropy-coded data is scanned with `memchr` for the next
+/// marker. Frames with corrupted marker structure are skipped.
+const uint8_t* find_frame(const uint8_t* begin, const uint8_t* end, JpegFrame& frame) noexcept;
+
+}  // namespace mjpeg
+
+/// \brief MJPEG stream read from a memory-mapped file.
+///
+/// Maps the whole file into memory and hands out views of consecutive frames
+/// in it without copying any data. A file of a single JPEG image is an MJPEG
+/// stream of a single frame. Views remain valid until the stream is closed.
+class MappedMjpegStream {
+
+    public:
+
+        MappedMjpegStream() = default;
+        ~MappedMjpegStream();
+        MappedMjpegStream(const MappedMjpegStream& other) = delete;
+        MappedMjpegStream& operator=(const MappedMjpegStream& other) = delete;
+        MappedMjpegStream(MappedMjpegStream&& other) = delete;
+        MappedMjpegStream& operator=(MappedMjpegStream&& other) = delete;
+
+        /// \brief Maps a file into memory, closing any previously mapped one.
+        ///
+        /// \param path  Path to the file.
+        /// \retval      true on success.
+        /// \retval      false otherwise.
+        bool open(const char* path) noexcept;
+
+        /// \brief Unmaps the file, invalidating all the views handed out.
+        void close() noexcept;
+
+        /// \brief Retrieves the next frame from the stream.
+        ///
+        /// \return  A view of the next frame or an empty view after the last one.
+        JpegFrame next_frame() noexcept;
+
+        /// \brief Restarts the stream from the first frame.
+        void rewind() noexcept;
+
+    private:
+
+        const uint8_t* m_data {nullptr};
+        size_t m_size {};
+        const uint8_t* m_cursor {nullptr};
+};
+
+/// \brief MJPEG stream read from a file descriptor into a reusable buffer.
+///
+/// \tparam BUFF_SIZE  Size of the internal buffer in bytes. Frames larger than
+///                    that are dropped.
+///
+/// Suitable for sockets and pipes as well as for regular files. Data is read
+/// in chunks as large as the free part of the internal buffer allows. Frame
+/// views point directly into the buffer and remain valid until the next call
+/// to next_frame(). Only the (usually small) unconsumed tail of a truncated
+/// frame is ever moved within the buffer, to make room for the next chunk.
+/// Does not take ownership of the file descriptor.
+template<size_t BUFF_SIZE>
+class BufferedMjpegStream {
+
+    public:
+
+        /// \param fd  File descriptor to read the stream from.
+        explicit BufferedMjpegStream(const int fd) noexcept :
+            m_fd(fd)
+            {}
+
+        /// \brief Retrieves the next frame from the stream.
+        ///
+        /// \return  A view of the next frame or an empty view if the end of the
+        ///          stream is reached or reading from it fails.
+        ///
+        /// Blocks on reading from the file descriptor if there is no complete
+        /// frame in the buffer.
+        JpegFrame next_frame() noexcept {
+
+            while (true) {
+
+                JpegFrame frame;
+                const uint8_t* const next = mjpeg::find_frame(&m_buff[m_begin], &m_buff[m_end], frame);
+                m_begin = next - m_buff;
+
+                if (frame) {
+
+                    return frame;
+                }
+
+                // move the unconsumed tail (if any) to the beginning of the buffer
+                if (m_begin) {
+
+                    std::memmove(m_buff, &m_buff[m_begin], m_end - m_begin);
+                    m_end -= m_begin;
+                    m_begin = 0;
+                }
+
+                // a frame that does not fit into the buffer is dropped, scanning
+                // is resynchronized on the next SOI marker
+                if (m_end == BUFF_SIZE) {
+
+                    m_end = 0;
+                }
+
+                const ssize_t bytes_read = ::read(m_fd, &m_buff[m_end], BUFF_SIZE - m_end);
+
+                if (bytes_read < 0 && errno == EINTR) {
+
+                    continue;
+                }
+
+                if (bytes_read <= 0) {
+
+                    return {};
+                }
+
+                m_end += bytes_read;
+            }
+        }
+
+    private:
+
+        const int m_fd {-1};
+        size_t m_begin {};
+        size_t m_end {};
+        uint8_t m_buff[BUFF_SIZE];
+};
+
+}  // namespace mdetect
@@ -0,0 +1,133 @@
+#include "RoiLog.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+
+using namespace mdetect;
+
+void roi_log::format_segment_name(char* const name_buff, const uint64_t first_timestamp, const char* const extension) noexcept {
+
+    std::snprintf(name_buff, SEGMENT_NAME_LENGTH + 1, "roi_%020" PRIu64 "%s", first_timestamp, extension);
+}
+
+std::string roi_log::segment_path(const std::string& dir, const uint64_t first_timestamp, const char* const extension) {
+
+    char name[SEGMENT_NAME_LENGTH + 1];
+    format_segment_name(name, first_timestamp, extension);
+
+    return (std::filesystem::path(dir) / name).string();
+}
+
+bool RoiLogReader::open(const std::string& dir) {
+
+    m_segment_paths.clear();
+    m_entries.clear();
+
+    std::error_code error;
+    std::vector<std::filesystem::path> index_paths;
+
+    for (const auto& dir_entry : std::filesystem::directory_iterator(dir, error)) {
+
+        const auto& path = dir_entry.path();
+
+        if (dir_entry.is_regular_file() && path.extension() == ".idx" && path.stem().string().rfind("roi_", 0) == 0) {
+
+            index_paths.push_back(path);
+        }
+    }
+
+    if (error) {
+
+        return false;
+    }
+
+    // zero-padded timestamps in file names make lexicographic order chronological
+    std::sort(index_paths.begin(), index_paths.end());
+
+    for (const auto& index_path : index_paths) {
+
+        std::ifstream index_file(index_path, std::ios::binary);
+
+        if (!index_file) {
+
+            return false;
+        }
+
+        const size_t segment_idx = m_segment_paths.size();
+        m_segment_paths.push_back(std::filesystem::path(index_path).replace_extension(".log").string());
+
+        roi_log::IndexEntry index_entry;
+        while (index_file.read(reinterpret_cast<char*>(&index_entry), sizeof(index_entry))) {
+
+            m_entries.push_back({index_entry.timestamp, index_entry.offset, segment_idx});
+        }
+    }
+
+    std::stable_sort(m_entries.begin(), m_entries.end(), [](const Entry& lhs, const Entry& rhs) {
+
+        return lhs.timestamp < rhs.timestamp;
+    });
+
+    return true;
+}
+
+std::pair<size_t, size_t> RoiLogReader::find(const uint64_t timestamp) const noexcept {
+
+    const auto [first, last] = std::equal_range(m_entries.begin(), m_entries.end(), Entry {timestamp, 0, 0},
+                                                [](const Entry& lhs, const Entry& rhs) {
+
+        return lhs.timestamp < rhs.timestamp;
+    });
+
+    return {first - m_entries.begin(), last - m_entries.begin()};
+}
+
+bool RoiLogReader::read_header(const size_t entry_idx, roi_log::RecordHeader& header) const {
+
+    return read(entry_idx, header, nullptr, 0);
+}
+
+bool RoiLogReader::read(const size_t entry_idx, roi_log::RecordHeader& header, uint8_t* const crop_buff, const size_t buff_size) const {
+
+    if (entry_idx >= m_entries.size()) {
+
+        return false;
+    }
+
+    const Entry& entry = m_entries[entry_idx];
+    std::ifstream segment_file(m_segment_paths[entry.segment_idx], std::ios::binary);
+
+    if (!segment_file.seekg(entry.offset) || !segment_file.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+
+        return false;
+    }
+
+    if (header.magic != roi_log::RECORD_MAGIC || header.timestamp != entry.timestamp) {
+
+        return false;
+    }
+
+    // header only
+    if (!crop_buff) {
+
+        return true;
+    }
+
+    const size_t crop_size = header.crop_width * header.crop_height;
+
+    if (crop_size > buff_size) {
+
+        return false;
+    }
+
+    return static_cast<bool>(segment_file.read(reinterpret_cast<char*>(crop_buff), crop_size));
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+namespace mdetect {
+
+/// \brief On-disk format of segmented ROI logs.
+///
+/// A log is a directory of segments. Each segment consists of a data file
+/// (`roi_<timestamp>.log`) holding records back to back and an index file
+/// (`roi_<timestamp>.idx`) holding one IndexEntry per record, where
+/// `<timestamp>` is the zero-padded timestamp of the first record in the
+/// segment. A record is a RecordHeader followed by `crop_width * crop_height`
+/// bytes of raw 8-bit grayscale crop. All values are stored in native byte
+/// order.
+namespace roi_log {
+
+/// \brief Marker at the start of each record ("ROI1" in little-endian).
+constexpr uint32_t RECORD_MAGIC = 0x31494F52;
+
+/// \brief Header preceding crop pixel data in a segment data file.
+struct RecordHeader {
+
+    uint32_t magic {RECORD_MAGIC};
+    uint32_t frame_id {};
+    uint64_t timestamp {};
+    uint16_t bbox_topleft_X {};
+    uint16_t bbox_topleft_Y {};
+    uint16_t bbox_bottomright_X {};
+    uint16_t bbox_bottomright_Y {};
+    uint16_t crop_width {};
+    uint16_t crop_height {};
+    uint32_t _reserved {};
+};
+
+static_assert(sizeof(RecordHeader) == 32, "RecordHeader must be packed into 32 bytes");
+
+/// \brief Entry of a segment index file.
+struct IndexEntry {
+
+    uint64_t timestamp {};
+    uint64_t offset {};     ///< Offset of the record within the segment data file.
+};
+
+/// \brief Length of segment file names, which are of fixed width.
+constexpr size_t SEGMENT_NAME_LENGTH = 28;
+
+/// \brief Formats the name of a segment file.
+///
+/// \param name_buff        Buffer of at least `SEGMENT_NAME_LENGTH + 1`
+///                         bytes to write the null-terminated name into.
+/// \param first_timestamp  Timestamp of the first record in the segment.
+/// \param extension        Either ".log" or ".idx".
+void format_segment_name(char* name_buff, uint64_t first_timestamp, const char* extension) noexcept;
+
+/// \brief Composes the path of a segment file.
+///
+/// \param dir              Log directory.
+/// \param first_timestamp  Timestamp of the first record in the segment.
+/// \param extension        Either ".log" or ".idx".
+/// \return                 Path to the segment file, ending with its
+///                         name (see format_segment_name()).
+std::string segment_path(const std::string& dir, uint64_t first_timestamp, const char* extension);
+
+}  // namespace roi_log
+
+/// \brief Random access reader of segmented ROI logs written by RoiLogWriter.
+///
+/// Loads index files of all the segments on open() and reads individual
+/// records on demand.
+class RoiLogReader {
+
+    public:
+
+        /// \brief Location of a record within the log.
+        struct Entry {
+
+            uint64_t timestamp {};
+            uint64_t offset {};
+            size_t segment_idx {};
+        };
+
+        /// \brief Loads the indices of all the segments in a log directory.
+        ///
+        /// \param dir  Log directory.
+        /// \retval     true on success.
+        /// \retval     false otherwise.
+        ///
+        /// Entries are ordered by timestamp, records with equal timestamps
+        /// retain the order in which they were written.
+        bool open(const std::string& dir);
+
+        /// \brief Retrieves all the indexed entries.
+        const std::vector<Entry>& entries() const noexcept {
+
+            return m_entries;
+        }
+
+        /// \brief Finds the range of entries with the given timestamp.
+        ///
+        /// \param timestamp  Frame timestamp to look for.
+        /// \return           Indices `[first, last)` into entries(). Empty if
+        ///                   there is no record with the given timestamp.
+        std::pair<size_t, size_t> find(uint64_t timestamp) const noexcept;
+
+        /// \brief Reads the header of a record.
+        ///
+        /// \param entry_idx  Index of the entry in entries().
+        /// \param header     Record header to read into.
+        /// \retval           true on success.
+        /// \retval           false if the record cannot be read or is corrupted.
+        bool read_header(size_t entry_idx, roi_log::RecordHeader& header) const;
+
+        /// \brief Reads a record.
+        ///
+        /// \param entry_idx  Index of the entry in entries().
+        /// \param header     Record header to read into.
+        /// \param crop_buff  Buffer to read crop pixel data into.
+        /// \param buff_size  Size of `crop_buff` in bytes.
+        /// \retval           true on success.
+        /// \retval           false if the record cannot be read, is corrupted or
+        ///                   its crop does not fit into `crop_buff`.
+        bool read(size_t entry_idx, roi_log::RecordHeader& header, uint8_t* crop_buff, size_t buff_size) const;
+
+    private:
+
+        std::vector<std::string> m_segment_paths {};
+        std::vector<Entry> m_entries {};
+};
+
+}  // namespace mdetect
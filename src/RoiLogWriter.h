@@ -0,0 +1,388 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "mdjpeg.h"
+
+#include "RoiLog.h"
+
+
+namespace mdetect {
+
+/// \brief Asynchronous, batched writer of detected movement crops to a segmented ROI log.
+///
+/// \tparam MAX_CROP_SIZE  The maximum size of a single crop in bytes (i.e. `width * height`).
+/// \tparam BATCH_SIZE     Number of records in a batch.
+/// \tparam BATCHES_COUNT  Number of batches in rotation.
+///
+/// Records (crops along with their bounding box and frame metadata) are
+/// appended to preallocated batches. Each full batch is handed over to a
+/// background thread which writes it out with a single system call per
+/// segment file. The calling thread never blocks on I/O: if all the batches
+/// are still waiting to be written, records are dropped and counted instead.
+/// See roi_log for the on-disk format and RoiLogReader for reading it back.
+///
+/// Storage for all the batches is a part of the object (about
+/// `MAX_CROP_SIZE * BATCH_SIZE * BATCHES_COUNT` bytes) so larger
+/// configurations are best given static storage duration.
+template<uint32_t MAX_CROP_SIZE, uint8_t BATCH_SIZE = 16, uint8_t BATCHES_COUNT = 4>
+class RoiLogWriter {
+
+    static_assert(BATCH_SIZE > 0 && BATCHES_COUNT > 1, "at least one record per batch and two batches are needed");
+
+    public:
+
+        /// \param dir               Existing directory to write the log into.
+        /// \param max_segment_size  Size in bytes after which a new segment is started.
+        ///
+        /// Starts the background writing thread.
+        explicit RoiLogWriter(const std::string& dir, const size_t max_segment_size = 64 * 1024 * 1024) :
+            m_segment_path(roi_log::segment_path(dir, 0, ".log")),
+            m_max_segment_size(max_segment_size),
+            m_thread(&RoiLogWriter::run, this)
+            {}
+
+        ~RoiLogWriter() {
+
+            close();
+        }
+
+        RoiLogWriter(const RoiLogWriter& other) = delete;
+        RoiLogWriter& operator=(const RoiLogWriter& other) = delete;
+        RoiLogWriter(RoiLogWriter&& other) = delete;
+        RoiLogWriter& operator=(RoiLogWriter&& other) = delete;
+
+        /// \brief Appends a record to the log.
+        ///
+        /// \param timestamp    Timestamp of the frame the crop was taken from.
+        /// \param frame_id     Identifier of the frame the crop was taken from.
+        /// \param bbox         Bounding box of the crop within the frame.
+        /// \param crop_buff    Raw 8-bit grayscale pixel data of the crop.
+        /// \param crop_width   Width of the crop in pixels.
+        /// \param crop_height  Height of the crop in pixels.
+        /// \retval             true if the record was queued for writing.
+        /// \retval             false if it was dropped, either because the crop
+        ///                     is too large or because no batch is available.
+        ///
+        /// Never blocks on I/O. The record is written out once its batch is
+        /// full or on flush().
+        bool append(const uint64_t timestamp,
+                    const uint32_t frame_id,
+                    const mdjpeg::BoundingBox& bbox,
+                    const uint8_t* const crop_buff,
+                    const uint16_t crop_width,
+                    const uint16_t crop_height) noexcept {
+
+            const uint32_t crop_size = crop_width * crop_height;
+
+            if (crop_size > MAX_CROP_SIZE || !acquire_batch()) {
+
+                ++m_dropped_count;
+
+                return false;
+            }
+
+            Batch& batch = m_batches[m_fill_idx];
+            const uint8_t record_idx = batch.records_count++;
+
+            roi_log::RecordHeader& header = batch.headers[record_idx];
+            header = {};
+            header.frame_id = frame_id;
+            header.timestamp = timestamp;
+            header.bbox_topleft_X = bbox.topleft_X;
+            header.bbox_topleft_Y = bbox.topleft_Y;
+            header.bbox_bottomright_X = bbox.bottomright_X;
+            header.bbox_bottomright_Y = bbox.bottomright_Y;
+            header.crop_width = crop_width;
+            header.crop_height = crop_height;
+
+            std::memcpy(batch.crops[record_idx], crop_buff, crop_size);
+
+            if (batch.records_count == BATCH_SIZE) {
+
+                hand_over_batch();
+            }
+
+            return true;
+        }
+
+        /// \brief Hands over the partially filled batch (if any) for writing.
+        ///
+        /// Does not wait for the batch to be written.
+        void flush() noexcept {
+
+            if (m_is_filling && m_batches[m_fill_idx].records_count) {
+
+                hand_over_batch();
+            }
+        }
+
+        /// \brief Flushes, waits for all the handed over batches to be written and stops the background thread.
+        ///
+        /// Records appended afterwards are dropped.
+        void close() noexcept {
+
+            if (!m_thread.joinable()) {
+
+                return;
+            }
+
+            flush();
+
+            {
+                const std::lock_guard<std::mutex> lock(m_mutex);
+                m_is_stopping = true;
+            }
+
+            m_cv.notify_one();
+            m_thread.join();
+        }
+
+        /// \brief Retrieves the number of records dropped or failed to be written so far.
+        uint32_t get_dropped_count() const noexcept {
+
+            return m_dropped_count;
+        }
+
+    private:
+
+        enum class BatchState : uint8_t {
+
+            free,
+            filling,
+            full
+        };
+
+        struct Batch {
+
+            uint8_t records_count {};
+            roi_log::RecordHeader headers[BATCH_SIZE];
+            uint8_t crops[BATCH_SIZE][MAX_CROP_SIZE];
+        };
+
+        // path of the segment files, their fixed-width names are formatted in place on opening
+        // so that the background thread does not allocate
+        std::string m_segment_path;
+        const size_t m_max_segment_size {};
+
+        Batch m_batches[BATCHES_COUNT] {};
+        BatchState m_states[BATCHES_COUNT] {};
+
+        // owned by the calling thread
+        uint8_t m_fill_idx {};
+        bool m_is_filling {false};
+
+        // owned by the background thread
+        int m_log_fd {-1};
+        int m_index_fd {-1};
+        size_t m_segment_size {};
+
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        bool m_is_stopping {false};
+        std::atomic<uint32_t> m_dropped_count {};
+
+        // declared last so that everything it uses is initialized before it starts
+        std::thread m_thread;
+
+        // makes sure the batch at `m_fill_idx` is available for filling
+        bool acquire_batch() noexcept {
+
+            if (m_is_filling) {
+
+                return true;
+            }
+
+            const std::lock_guard<std::mutex> lock(m_mutex);
+
+            if (m_is_stopping || m_states[m_fill_idx] != BatchState::free) {
+
+                return false;
+            }
+
+            m_states[m_fill_idx] = BatchState::filling;
+            m_batches[m_fill_idx].records_count = 0;
+            m_is_filling = true;
+
+            return true;
+        }
+
+        // passes the batch being filled on to the background thread and moves on to the next one
+        void hand_over_batch() noexcept {
+
+            {
+                const std::lock_guard<std::mutex> lock(m_mutex);
+                m_states[m_fill_idx] = BatchState::full;
+            }
+
+            m_cv.notify_one();
+
+            m_fill_idx = (m_fill_idx + 1) % BATCHES_COUNT;
+            m_is_filling = false;
+        }
+
+        // background thread body, writes out full batches in the order they were handed over
+        void run() noexcept {
+
+            uint8_t write_idx = 0;
+
+            while (true) {
+
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_cv.wait(lock, [&] { return m_states[write_idx] == BatchState::full || m_is_stopping; });
+
+                    // all the batches handed over before stopping have been written
+                    if (m_states[write_idx] != BatchState::full) {
+
+                        break;
+                    }
+                }
+
+                write_batch(m_batches[write_idx]);
+
+                {
+                    const std::lock_guard<std::mutex> lock(m_mutex);
+                    m_states[write_idx] = BatchState::free;
+                }
+
+                write_idx = (write_idx + 1) % BATCHES_COUNT;
+            }
+
+            close_segment();
+        }
+
+        // writes a batch as runs of records sharing the same segment, one `writev` per run
+        void write_batch(const Batch& batch) noexcept {
+
+            iovec log_iovs[2 * BATCH_SIZE];
+            roi_log::IndexEntry index_entries[BATCH_SIZE];
+            uint8_t run_length = 0;
+
+            for (uint8_t record_idx = 0; record_idx < batch.records_count; ++record_idx) {
+
+                const roi_log::RecordHeader& header = batch.headers[record_idx];
+                const size_t crop_size = header.crop_width * header.crop_height;
+                const size_t record_size = sizeof(header) + crop_size;
+
+                // start a new segment if the record does not fit into the current one
+                if (m_log_fd < 0 || (m_segment_size && m_segment_size + record_size > m_max_segment_size)) {
+
+                    write_run(log_iovs, index_entries, run_length);
+                    run_length = 0;
+
+                    open_segment(header.timestamp);
+                }
+
+                log_iovs[2 * run_length] = {const_cast<roi_log::RecordHeader*>(&header), sizeof(header)};
+                log_iovs[2 * run_length + 1] = {const_cast<uint8_t*>(batch.crops[record_idx]), crop_size};
+                index_entries[run_length] = {header.timestamp, m_segment_size};
+
+                m_segment_size += record_size;
+                ++run_length;
+            }
+
+            write_run(log_iovs, index_entries, run_length);
+        }
+
+        // writes records and their index entries to the current segment
+        void write_run(const iovec* const log_iovs, const roi_log::IndexEntry* const index_entries, const uint8_t run_length) noexcept {
+
+            if (!run_length) {
+
+                return;
+            }
+
+            size_t log_size = 0;
+            for (uint8_t iov_idx = 0; iov_idx < 2 * run_length; ++iov_idx) {
+
+                log_size += log_iovs[iov_idx].iov_len;
+            }
+
+            const size_t index_size = run_length * sizeof(roi_log::IndexEntry);
+
+            if (m_log_fd < 0) {
+
+                m_dropped_count += run_length;
+
+                return;
+            }
+
+            // both files as they were before the run, for rolling back partial writes
+            const off_t log_offset = index_entries[0].offset;
+            const off_t index_offset = ::lseek(m_index_fd, 0, SEEK_END);
+
+            if (index_offset < 0 ||
+                ::writev(m_log_fd, log_iovs, 2 * run_length) != static_cast<ssize_t>(log_size) ||
+                ::write(m_index_fd, index_entries, index_size) != static_cast<ssize_t>(index_size)) {
+
+                m_dropped_count += run_length;
+
+                // offsets of the records that follow assume the whole run was written, so
+                // the segment is rolled back (best effort) and closed, the next record
+                // starts afresh (reopening a segment re-syncs the size with the file)
+                if (index_offset >= 0) {
+
+                    [[maybe_unused]] const int log_result = ::ftruncate(m_log_fd, log_offset);
+                    [[maybe_unused]] const int index_result = ::ftruncate(m_index_fd, index_offset);
+                }
+
+                close_segment();
+            }
+        }
+
+        // closes the current segment (if any) and opens a new one named after `first_timestamp`
+        void open_segment(const uint64_t first_timestamp) noexcept {
+
+            close_segment();
+
+            char* const segment_name = &m_segment_path[m_segment_path.size() - roi_log::SEGMENT_NAME_LENGTH];
+            const int flags = O_WRONLY | O_CREAT | O_APPEND;
+
+            roi_log::format_segment_name(segment_name, first_timestamp, ".log");
+            m_log_fd = ::open(m_segment_path.c_str(), flags, 0644);
+
+            roi_log::format_segment_name(segment_name, first_timestamp, ".idx");
+            m_index_fd = ::open(m_segment_path.c_str(), flags, 0644);
+
+            if (m_log_fd < 0 || m_index_fd < 0) {
+
+                close_segment();
+
+                return;
+            }
+
+            // reopening an existing segment appends to it
+            m_segment_size = ::lseek(m_log_fd, 0, SEEK_END);
+        }
+
+        void close_segment() noexcept {
+
+            if (m_log_fd >= 0) {
+
+                ::close(m_log_fd);
+            }
+
+            if (m_index_fd >= 0) {
+
+                ::close(m_index_fd);
+            }
+
+            m_log_fd = -1;
+            m_index_fd = -1;
+            m_segment_size = 0;
+        }
+};
+
+}  // namespace mdetect
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstring>
+#include <algorithm>
+
+#include "mdjpeg.h"
+
+
+namespace mdetect {
+
+/// \brief Consumer of pixel rows streamed out by StreamingBlockWriter.
+class RowSink {
+
+    public:
+
+        virtual ~RowSink() = default;
+
+        /// \brief Consumes a single row of pixels.
+        ///
+        /// \param row      Raw 8-bit grayscale pixel data of the row. The
+        ///                 buffer belongs to the caller and is only valid (and
+        ///                 may be modified) for the duration of the call.
+        /// \param row_idx  Y-coordinate of the row.
+        ///
+        /// Rows are consumed in order, from top to bottom.
+        virtual void push_row(uint8_t* row, uint16_t row_idx) noexcept = 0;
+};
+
+/// \brief Block writer streaming out downscaled rows as soon as they are decoded.
+///
+/// \tparam FRAME_WIDTH   Width of the rows streamed out in pixels.
+/// \tparam FRAME_HEIGHT  Number of rows streamed out.
+/// \tparam BAND_ROWS     Number of output rows accumulated at the same time.
+///
+/// Plugs into the decoder in place of mdjpeg::DownscalingBlockWriter but,
+/// instead of writing into a frame buffer, averages decoded blocks into a
+/// narrow band of rows. Each output row is handed over to a RowSink as soon as
+/// all the blocks covering it have been decoded and its storage is reused for
+/// the rows further down. Any downscaling factor is supported (no upscaling).
+///
+/// The band must span all the output rows covered by the MCU rows being
+/// decoded, i.e. at least `ceil(MCU height * FRAME_HEIGHT / image height) + 1`
+/// rows. With 1:8 downscaling, \c 4 rows suffice for any chroma subsampling
+/// short of 4:1:0 (32 pixels high MCUs). Without downscaling, \c 17 rows are
+/// needed for 4:2:0 subsampled images.
+template<uint16_t FRAME_WIDTH, uint16_t FRAME_HEIGHT, uint8_t BAND_ROWS>
+class StreamingBlockWriter : public mdjpeg::BlockWriter {
+
+    static_assert(BAND_ROWS > 0, "at least one row is needed");
+
+    public:
+
+        /// \param sink  Consumer of the rows streamed out.
+        explicit StreamingBlockWriter(RowSink& sink) noexcept :
+            m_sink(sink)
+            {}
+
+        StreamingBlockWriter(const StreamingBlockWriter& other) = delete;
+        StreamingBlockWriter& operator=(const StreamingBlockWriter& other) = delete;
+        StreamingBlockWriter(StreamingBlockWriter&& other) = delete;
+        StreamingBlockWriter& operator=(StreamingBlockWriter&& other) = delete;
+
+        /// \brief Prepares for decoding an image of given size.
+        void init(const uint16_t src_width_px, const uint16_t src_height_px) noexcept override {
+
+            m_src_width = src_width_px;
+            m_src_height = src_height_px;
+            m_blocks_per_row = (src_width_px + 7) / 8;
+            m_block_rows = (src_height_px + 7) / 8;
+            m_complete_block_rows = 0;
+            m_next_row = 0;
+
+            // upscaling would leave some of the output pixels without a source
+            m_is_failed = src_width_px < FRAME_WIDTH || src_height_px < FRAME_HEIGHT;
+
+            std::memset(m_block_counts, 0, sizeof(m_block_counts));
+            std::memset(m_sums, 0, sizeof(m_sums));
+            std::memset(m_counts, 0, sizeof(m_counts));
+        }
+
+        /// \brief Accumulates a decoded 8x8 block and streams out the rows it completes.
+        ///
+        /// `dst` is not used, all the output goes to the sink.
+        void write([[maybe_unused]] uint8_t* const dst,
+                   const uint8_t* const src_block,
+                   const uint16_t src_block_X,
+                   const uint16_t src_block_Y) noexcept override {
+
+            // padding blocks of partial MCUs along the right and bottom edges
+            if (m_is_failed || src_block_X >= m_blocks_per_row || src_block_Y >= m_block_rows) {
+
+                return;
+            }
+
+            // blocks are expected to arrive in MCU order, covering at most a few block rows at once
+            if (src_block_Y < m_complete_block_rows || src_block_Y - m_complete_block_rows >= OPEN_BLOCK_ROWS) {
+
+                m_is_failed = true;
+
+                return;
+            }
+
+            for (uint8_t block_row = 0; block_row < 8; ++block_row) {
+
+                const uint32_t src_row = src_block_Y * 8 + block_row;
+
+                if (src_row >= m_src_height) {
+
+                    break;
+                }
+
+                const uint16_t row = src_row * FRAME_HEIGHT / m_src_height;
+
+                // the band is too narrow for the MCU rows being decoded
+                if (row - m_next_row >= BAND_ROWS) {
+
+                    m_is_failed = true;
+
+                    return;
+                }
+
+                uint32_t* const sums = m_sums[row % BAND_ROWS];
+                uint16_t* const counts = m_counts[row % BAND_ROWS];
+                const uint8_t* const src_row_pixels = &src_block[block_row * 8];
+
+                for (uint8_t block_col = 0; block_col < 8; ++block_col) {
+
+                    const uint32_t src_col = src_block_X * 8 + block_col;
+
+                    if (src_col >= m_src_width) {
+
+                        break;
+                    }
+
+                    const uint16_t col = src_col * FRAME_WIDTH / m_src_width;
+
+                    sums[col] += src_row_pixels[block_col];
+                    ++counts[col];
+                }
+            }
+
+            ++m_block_counts[src_block_Y % OPEN_BLOCK_ROWS];
+
+            // advance over the leading block rows decoded in full
+            while (m_complete_block_rows < m_block_rows &&
+                   m_block_counts[m_complete_block_rows % OPEN_BLOCK_ROWS] == m_blocks_per_row) {
+
+                m_block_counts[m_complete_block_rows % OPEN_BLOCK_ROWS] = 0;
+                ++m_complete_block_rows;
+            }
+
+            const uint32_t complete_src_rows = std::min<uint32_t>(m_complete_block_rows * 8, m_src_height);
+
+            // stream out the rows with all of their source rows decoded
+            while (m_next_row < FRAME_HEIGHT && (m_next_row + 1U) * m_src_height <= complete_src_rows * FRAME_HEIGHT) {
+
+                stream_out_row();
+            }
+        }
+
+        /// \brief Checks whether all the rows have been streamed out.
+        ///
+        /// \retval  true if the whole image has been decoded and streamed out.
+        /// \retval  false if decoding is incomplete or blocks could not be
+        ///          accommodated (upscaling, band too narrow, unexpected order).
+        bool is_complete() const noexcept {
+
+            return !m_is_failed && m_next_row == FRAME_HEIGHT;
+        }
+
+    private:
+
+        // block rows (power of two) tracked at once, the tallest MCUs span 4
+        static constexpr uint8_t OPEN_BLOCK_ROWS = 8;
+
+        RowSink& m_sink;
+        uint16_t m_src_width {};
+        uint16_t m_src_height {};
+        uint16_t m_blocks_per_row {};
+        uint16_t m_block_rows {};
+        uint16_t m_complete_block_rows {};
+        uint16_t m_next_row {};
+        bool m_is_failed {true};
+
+        uint16_t m_block_counts[OPEN_BLOCK_ROWS] {};
+        uint32_t m_sums[BAND_ROWS][FRAME_WIDTH] {};
+        uint16_t m_counts[BAND_ROWS][FRAME_WIDTH] {};
+        uint8_t m_row[FRAME_WIDTH] {};
+
+        // averages the next row, hands it over to the sink and frees its place in the band
+        void stream_out_row() noexcept {
+
+            uint32_t* const sums = m_sums[m_next_row % BAND_ROWS];
+            uint16_t* const counts = m_counts[m_next_row % BAND_ROWS];
+
+            for (uint16_t col = 0; col < FRAME_WIDTH; ++col) {
+
+                m_row[col] = (sums[col] + counts[col] / 2) / counts[col];
+                sums[col] = 0;
+                counts[col] = 0;
+            }
+
+            m_sink.push_row(m_row, m_next_row++);
+        }
+};
+
+}  // namespace mdetect
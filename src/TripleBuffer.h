@@ -0,0 +1,167 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <type_traits>
+
+
+namespace mdetect {
+
+/// \brief Wait-free exchange of snapshots between a single writer and a single reader.
+///
+/// \tparam T  Snapshot type (e.g. DetectionResult).
+///
+/// Of the three slots, one is owned by the writer, one by the reader and the
+/// one in the middle holds the latest snapshot published. Publishing and
+/// picking up snapshots are single atomic exchanges of the middle slot index,
+/// so neither side ever blocks, retries or allocates, and the reader always
+/// sees a complete snapshot. Snapshots published before the reader picks up
+/// the latest one are overwritten, i.e. the reader gets the most recent state
+/// rather than a queue.
+template<typename T>
+class TripleBuffer {
+
+    static_assert(std::is_trivially_copyable_v<T>, "snapshots are meant to be plain, fixed-size data");
+
+    public:
+
+        TripleBuffer() = default;
+        TripleBuffer(const TripleBuffer& other) = delete;
+        TripleBuffer& operator=(const TripleBuffer& other) = delete;
+        TripleBuffer(TripleBuffer&& other) = delete;
+        TripleBuffer& operator=(TripleBuffer&& other) = delete;
+
+        /// \brief Accesses the writer's slot for filling in the next snapshot (writer only).
+        T& back() noexcept {
+
+            return m_slots[m_back_idx].value;
+        }
+
+        /// \brief Publishes the snapshot in the writer's slot (writer only).
+        ///
+        /// The writer gets the previous middle slot in exchange, its contents
+        /// are stale.
+        void publish() noexcept {
+
+            m_back_idx = m_middle.exchange(m_back_idx | FRESH_FLAG, std::memory_order_acq_rel) & INDEX_MASK;
+        }
+
+        /// \brief Picks up the latest snapshot if a new one has been published since the last call (reader only).
+        ///
+        /// \retval  true if front() now holds a newly published snapshot.
+        /// \retval  false if there was none, front() is unchanged.
+        bool update() noexcept {
+
+            if (!(m_middle.load(std::memory_order_relaxed) & FRESH_FLAG)) {
+
+                return false;
+            }
+
+            m_front_idx = m_middle.exchange(m_front_idx, std::memory_order_acq_rel) & INDEX_MASK;
+
+            return true;
+        }
+
+        /// \brief Accesses the latest snapshot picked up by update() (reader only).
+        ///
+        /// A default-constructed snapshot until the first one is picked up.
+        const T& front() const noexcept {
+
+            return m_slots[m_front_idx].value;
+        }
+
+    private:
+
+        static constexpr uint8_t INDEX_MASK = 0x03;
+        static constexpr uint8_t FRESH_FLAG = 0x04;
+
+        // slots on separate cache lines, so that the writer and the reader do not contend
+        struct Slot {
+
+            alignas(64) T value {};
+        };
+
+        Slot m_slots[3] {};
+
+        // owned by the writer
+        uint8_t m_back_idx {0};
+
+        // owned by the reader
+        uint8_t m_front_idx {2};
+
+        alignas(64) std::atomic<uint8_t> m_middle {1};
+};
+
+/// \brief Wait-free publication of snapshots to a fixed set of concurrent readers.
+///
+/// \tparam T              Snapshot type (e.g. DetectionResult).
+/// \tparam READERS_COUNT  Number of reader threads.
+///
+/// Keeps a TripleBuffer per reader, so that any number of readers (e.g. UI,
+/// recorder and analytics threads) can grab the latest complete snapshot at
+/// their own pace, without locking, blocking the writer or each other. Each
+/// snapshot is copied once per reader, which is negligible for small,
+/// fixed-size snapshots such as DetectionResult.
+///
+/// Intended usage on the detection thread:
+/// \code
+///     detector.get_result(frame_id, result);
+///     publisher.publish(result);
+/// \endcode
+/// and on each reader thread:
+/// \code
+///     if (publisher.update(reader_idx)) {
+///
+///         const auto& latest = publisher.read(reader_idx);
+///         ...
+///     }
+/// \endcode
+template<typename T, uint8_t READERS_COUNT>
+class SnapshotPublisher {
+
+    static_assert(READERS_COUNT > 0, "at least one reader is needed");
+
+    public:
+
+        SnapshotPublisher() = default;
+        SnapshotPublisher(const SnapshotPublisher& other) = delete;
+        SnapshotPublisher& operator=(const SnapshotPublisher& other) = delete;
+        SnapshotPublisher(SnapshotPublisher&& other) = delete;
+        SnapshotPublisher& operator=(SnapshotPublisher&& other) = delete;
+
+        /// \brief Publishes a snapshot to all the readers (writer only).
+        void publish(const T& snapshot) noexcept {
+
+            for (auto& buffer : m_buffers) {
+
+                buffer.back() = snapshot;
+                buffer.publish();
+            }
+        }
+
+        /// \brief Picks up the latest snapshot for a reader (that reader only).
+        ///
+        /// \param reader_idx  Index of the reader, less than `READERS_COUNT`.
+        /// \retval            true if a new snapshot has been picked up.
+        /// \retval            false if there was none since the last call.
+        bool update(const uint8_t reader_idx) noexcept {
+
+            return m_buffers[reader_idx].update();
+        }
+
+        /// \brief Accesses the latest snapshot picked up by a reader (that reader only).
+        ///
+        /// \param reader_idx  Index of the reader, less than `READERS_COUNT`.
+        /// \return            The snapshot, valid until the next call to
+        ///                    update() by the same reader.
+        const T& read(const uint8_t reader_idx) const noexcept {
+
+            return m_buffers[reader_idx].front();
+        }
+
+    private:
+
+        TripleBuffer<T> m_buffers[READERS_COUNT] {};
+};
+
+}  // namespace mdetect
@@ -1,43 +1,60 @@
 #include <stdint.h>
 #include <sys/types.h>
+#include <chrono>
 #include <iostream>
+#include <string>
+#include <vector>
+#include <filesystem>
 
 #include "mdjpeg.h"
 
 #include "JpegMotionDetector.h"
+#include "MjpegStream.h"
+#include "RoiLogWriter.h"
 
 
 int main(int argc, char** argv) {
 
     if (argc != 3) {
 
-        std::cout << "usage: " << argv[0] << " input_directory output_directory\n";
+        std::cout << "usage: " << argv[0] << " input_directory|input_mjpeg_file output_directory\n";
 
         return 1;
     }
 
-    const std::filesystem::path input_dir = argv[1];
+    const std::filesystem::path input = argv[1];
 
-    // for testing/example purposes input image data is obtained from files within `input_dir`
-    if (!std::filesystem::is_directory(input_dir)) {
+    // for testing/example purposes input image data is obtained either from a
+    // directory of JPEG files or from a single (concatenated or multipart) MJPEG file
+    std::vector<std::filesystem::path> input_paths;
 
-        std::cerr << "invalid input directory: " << input_dir << "\n";
+    if (std::filesystem::is_directory(input)) {
 
-        return 1;
+        // get only the paths for filenames matching "`input`/*.jpg"
+        input_paths = mdjpeg::test_utils::get_input_img_paths(input);
     }
 
-    // get only the paths for filenames matching "`input_dir`/*.jpg"
-    const auto input_paths = mdjpeg::test_utils::get_input_img_paths(input_dir);
+    else if (std::filesystem::is_regular_file(input)) {
+
+        input_paths.push_back(input);
+    }
 
-    // motion detection can only find "movements" between multiple frames
-    if (input_paths.size() < 2) {
+    else {
 
-        std::cout << "nothing to do in: " << input_dir << "\n";
+        std::cerr << "invalid input: " << input << "\n";
+
+        return 1;
+    }
+
+    if (input_paths.empty()) {
+
+        std::cout << "nothing to do in: " << input << "\n";
 
         return 0;
     }
 
-    // for testing/example purposes output image data is stored to files in `output_dir`
+    // for testing/example purposes output image data is appended to an ROI log in `output_dir`
+    // (individual crops can be exported from it by `roi_log_export` tool)
     const std::filesystem::path output_dir = argv[2];
     std::filesystem::create_directories(output_dir);
 
@@ -61,106 +78,135 @@ int main(int argc, char** argv) {
     // `downscaling_block_writer` needed for writing oversized input to fixed-sized `dest_buff`
     mdjpeg::DownscalingBlockWriter<dest_width, dest_height> downscaling_block_writer;
 
+    // `roi_log_writer` writes `dest_buff` contents out in batches on its own background thread
+    // (its preallocated batches are too large for the stack, hence static)
+    static mdetect::RoiLogWriter<dest_width * dest_height> roi_log_writer(output_dir);
+
     // a single JPEG decoder object used by motion detector as well as `main`
     mdjpeg::JpegDecoder jpeg_decoder;
 
     // create `motion_detector` that internally operates with frame resolution of
     // `downscaled_width` x `downscaled_height` pixels
     // (using 1:8 scale is recommended for noise reduction and maximum efficiency)
-    mdetect::JpegMotionDetector<downscaled_width, downscaled_height> motion_detector(jpeg_decoder);
+    using MotionDetector = mdetect::JpegMotionDetector<downscaled_width, downscaled_height>;
+    MotionDetector motion_detector(jpeg_decoder);
 
-    // `input_paths` is used to mock a steady stream of images coming from a camera
-    auto input_path_it = input_paths.begin();
+    // report frames with at least half of the pixels changed as global changes in illumination
+    // rather than as frame-sized movements (not checked for by default), and have such frames
+    // replace the reference frame right away
+    motion_detector.set_global_change_limits(0, 50, true);
 
+    // each input file is memory-mapped and treated as an MJPEG stream (a single
+    // JPEG image being a stream of a single frame) to mock a steady stream of
+    // images coming from a camera; frames are passed to `motion_detector`
+    // directly from the mapped memory, without copying
+    mdetect::MappedMjpegStream input_stream;
 
-    // `input_paths` is purposely not indefinite; real stream would be
-    while (input_path_it != input_paths.end()) {
+    // initial reference frame is set from the first frame successfully decoded
+    bool is_reference_set = false;
 
-        // read compressed data from an input image into `buffer` of size `size`
-        // (for testing/example purposes the data buffer is allocated on the heap here)
-        const auto [buffer, size] = mdjpeg::test_utils::read_raw_jpeg_from_file(*input_path_it++);
+    // identifies frames processed across all the input files
+    uint32_t frame_id = 0;
 
-        // set initial reference frame
-        const bool reference_success = motion_detector.set_reference(buffer, size);
+    // `input_paths` is purposely not indefinite; real stream would be
+    for (const auto& input_path : input_paths) {
 
-        // clean up after use of image data (depends on the source of image data)
-        delete[] buffer;
+        if (!input_stream.open(input_path.c_str())) {
 
-        if (reference_success) {
+            std::cout << "cannot read input file: " << input_path << "\n";
 
-            break;
+            continue;
         }
-    }
 
+        uint frame_idx = 0;
+        while (const auto frame = input_stream.next_frame()) {
 
-    // process the rest of input images
-    // `input_paths` is purposely not indefinite; real stream would be
-    while (input_path_it != input_paths.end()) {
+            // name frames after their input file, numbering all but the first one in the file
+            std::string frame_name = input_path.stem();
+            if (frame_idx) {
 
-        std::cout << "processing image: " << *input_path_it << "\n";
+                frame_name += "-" + std::to_string(frame_idx);
+            }
+            ++frame_idx;
 
-        // read compressed data from an input image into `buffer` of size `size`
-        // (for testing/example purposes the data buffer is allocated on the heap here)
-        const auto [buffer, size] = mdjpeg::test_utils::read_raw_jpeg_from_file(*input_path_it);
+            if (!is_reference_set) {
 
-        // detect "movements" in the current frame with respect to the reference frame
-        const uint8_t detection_threshold = 127;
-        const int movements_count = motion_detector.detect(buffer, size, detection_threshold);
+                // set initial reference frame
+                is_reference_set = motion_detector.set_reference(frame.data, frame.size);
 
-        if (movements_count < 0) {
+                continue;
+            }
 
-            std::cout << "   JPEG decompression FAILED.\n";
+            std::cout << "processing image: " << frame_name << "\n";
 
-            // clean up after use of image data (depends on the source of image data)
-            delete[] buffer;
+            // frame arrival time in microseconds since epoch, used for indexing the ROI log
+            const uint64_t timestamp = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+            ++frame_id;
 
-            ++input_path_it;
+            // detect "movements" in the current frame with respect to the reference frame
+            const uint8_t detection_threshold = 127;
+            const int movements_count = motion_detector.detect(frame.data, frame.size, detection_threshold);
 
-            continue;
-        }
+            if (movements_count == MotionDetector::DECODE_FAILED) {
 
+                std::cout << "   JPEG decompression FAILED.\n";
 
-        // at this point the `jpeg_decoder` object has been assigned with the current frame buffer
+                continue;
+            }
 
-        // not interested in very small bounding boxes (optional filter-out)
-        const uint min_bbox_size = 16;
+            // lights switched on or similar, nothing worth decoding
+            // (the frame is already the new reference)
+            if (movements_count == MotionDetector::GLOBAL_CHANGE) {
 
-        // not interested in bounding boxes larger than half of frame height (optional filter-out)
-        const uint max_bbox_size = downscaled_height / 2;
+                std::cout << "   global change in illumination.\n";
 
-        // set boundaries for extending non-square bounding boxes into squares
-        const mdjpeg::BoundingBox frame_boundaries(0, 0, downscaled_width, downscaled_height);
+                continue;
+            }
 
-        // process individual "movements" one by one
-        uint movement_counter = 0;
-        while (auto bbox = motion_detector.get_bounding_box()) {
 
-            // detected area can be a non-square rectangle, extend it into a square if possible
-            bbox.expand_to_square(frame_boundaries);
+            // at this point the `jpeg_decoder` object has been assigned with the current frame buffer
 
-            // ignore bounding boxes outside of specified size range (optional filter-out)
-            if (bbox.width() < min_bbox_size || bbox.width() > max_bbox_size) {
+            // not interested in very small bounding boxes (optional filter-out)
+            const uint min_bbox_size = 16;
 
-                continue;
-            }
+            // not interested in bounding boxes larger than half of frame height (optional filter-out)
+            const uint max_bbox_size = downscaled_height / 2;
 
-            // use bounding box info to specify which part of the frame to decode from original JPEG buffer
-            jpeg_decoder.luma_decode(dest_buff, bbox, downscaling_block_writer);
+            // set boundaries for extending non-square bounding boxes into squares
+            const mdjpeg::BoundingBox frame_boundaries(0, 0, downscaled_width, downscaled_height);
 
-            // this is where individual "movement" image decoded into `dest_buff` can be processed
-            // (for testing/example purposes just write it to disk)
-            std::filesystem::path output_path = output_dir / input_path_it->stem();
-            output_path += "_" + std::to_string(movement_counter++) + ".pgm";
-            mdjpeg::test_utils::write_as_pgm(output_path, dest_buff, dest_width, dest_height);
+            // process individual "movements" one by one
+            while (auto bbox = motion_detector.get_bounding_box()) {
+
+                // detected area can be a non-square rectangle, extend it into a square if possible
+                bbox.expand_to_square(frame_boundaries);
+
+                // ignore bounding boxes outside of specified size range (optional filter-out)
+                if (bbox.width() < min_bbox_size || bbox.width() > max_bbox_size) {
+
+                    continue;
+                }
+
+                // use bounding box info to specify which part of the frame to decode from original JPEG buffer
+                jpeg_decoder.luma_decode(dest_buff, bbox, downscaling_block_writer);
+
+                // this is where individual "movement" image decoded into `dest_buff` can be processed
+                // (for testing/example purposes just log it to disk)
+                roi_log_writer.append(timestamp, frame_id, bbox, dest_buff, dest_width, dest_height);
+            }
+
+            // update reference frame using the current input image
+            motion_detector.set_reference(frame.data, frame.size);
         }
+    }
 
-        // update reference frame using the current input image
-        motion_detector.set_reference(buffer, size);
+    // write out whatever is left in the batches
+    roi_log_writer.close();
 
-        // clean up after use of image data (depends on the source of image data)
-        delete[] buffer;
+    if (roi_log_writer.get_dropped_count()) {
 
-        ++input_path_it;
+        std::cout << "dropped movements: " << roi_log_writer.get_dropped_count() << "\n";
     }
 
     return 0;
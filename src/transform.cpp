@@ -1,47 +1,330 @@
 #include "transform.h"
 
+#include <stdint.h>
 #include <cmath>
+#include <algorithm>
+#include <functional>
 
-#include "Kernel.h"
 #include "Image.h"
 
 
 using namespace mdetect;
 
-void transform::absdiff(Image &dst, const Image &src1, const Image &src2) noexcept {
+namespace {
+
+// running extremum engine shared by morphological operations
+//
+// Slides a window of `reach_back + 1 + reach_ahead` pixels along a line of
+// `length` pixels accessed through `pixel` and replaces each pixel with the
+// extremum of the window around it (clipped to the line, which is equivalent
+// to padding with the neutral value). The extremum is tracked by a monotonic
+// wedge of candidates, i.e. in amortized constant time per pixel regardless
+// of the window size. Candidate values are kept in the wedge along with their
+// positions so the line is safely overwritten in place. `Compare` is
+// `std::greater` for running maximum and `std::less` for running minimum.
+template<typename Compare, typename Accessor>
+void running_extremum_line(const Accessor& pixel, const uint16_t length, const uint8_t reach_back, const uint8_t reach_ahead) noexcept {
+
+    struct Candidate {
+
+        int32_t idx;
+        uint8_t value;
+    };
+
+    // window holds at most 255 pixels, so a ring buffer of 256 candidates
+    // indexed by wrapping `uint8_t` counters never overflows
+    Candidate wedge[256];
+    uint8_t head = 0;
+    uint8_t tail = 0;
+
+    const Compare is_better {};
+    const int32_t window_size = reach_back + 1 + reach_ahead;
+
+    for (int32_t in_idx = 0; in_idx < length + reach_ahead; ++in_idx) {
+
+        // drop the candidate that slid out of the window
+        if (head != tail && wedge[head].idx <= in_idx - window_size) {
+
+            ++head;
+        }
+
+        if (in_idx < length) {
+
+            const uint8_t value = pixel(in_idx);
+
+            // drop candidates that can no longer be the extremum
+            while (head != tail && !is_better(wedge[static_cast<uint8_t>(tail - 1)].value, value)) {
+
+                --tail;
+            }
+
+            wedge[tail++] = {in_idx, value};
+        }
+
+        const int32_t out_idx = in_idx - reach_ahead;
+
+        if (out_idx >= 0) {
+
+            pixel(out_idx) = wedge[head].value;
+        }
+    }
+}
+
+// applies running extremum over a rectangular window in place, separably
+// (rows first, then columns)
+template<typename Compare>
+void running_extremum(Image& img, const uint8_t reach_back, const uint8_t reach_ahead) noexcept {
+
+    if (!reach_back && !reach_ahead) {
+
+        return;
+    }
+
+    for (uint16_t row = 0; row < img.height; ++row) {
+
+        running_extremum_line<Compare>([&img, row](const int32_t col) -> uint8_t& { return img.at(row, col); },
+                                       img.width, reach_back, reach_ahead);
+    }
+
+    for (uint16_t col = 0; col < img.width; ++col) {
+
+        running_extremum_line<Compare>([&img, col](const int32_t row) -> uint8_t& { return img.at(row, col); },
+                                       img.height, reach_back, reach_ahead);
+    }
+}
+
+// copies pixels front to back, which is also safe for overlapping frame
+// buffers as long as the destination does not start after the source
+void copy(Image& dst, const Image& src) noexcept {
+
+    if (&dst == &src) {
+
+        return;
+    }
 
     for (uint16_t row = 0; row < dst.height; ++row) {
 
         for (uint16_t col = 0; col < dst.width; ++col) {
 
-            dst.at(row, col) = std::abs(src1.at(row, col) - src2.at(row, col));
+            dst.at(row, col) = src.at(row, col);
         }
     }
 }
 
-void transform::threshold(Image& dst, const Image& src, const uint8_t thresh_val) noexcept {
+}  // namespace
+
+uint64_t transform::absdiff(Image &dst, const Image &src1, const Image &src2) noexcept {
+
+    uint64_t sum = 0;
+
+    for (uint16_t row = 0; row < dst.height; ++row) {
+
+        // cannot overflow for any row width
+        uint32_t row_sum = 0;
+
+        for (uint16_t col = 0; col < dst.width; ++col) {
+
+            const uint8_t diff = std::abs(src1.at(row, col) - src2.at(row, col));
+
+            dst.at(row, col) = diff;
+            row_sum += diff;
+        }
+
+        sum += row_sum;
+    }
+
+    return sum;
+}
+
+uint64_t transform::absdiff(Image& dst, const Image& src1, const Image& src2, uint32_t* const tile_sums, const uint8_t tile_size) noexcept {
+
+    const uint16_t tile_cols = (dst.width + tile_size - 1) / tile_size;
+    uint64_t sum = 0;
+
+    for (uint16_t row = 0; row < dst.height; ++row) {
+
+        uint32_t* const row_tile_sums = &tile_sums[(row / tile_size) * tile_cols];
+
+        for (uint16_t tile_col = 0; tile_col < tile_cols; ++tile_col) {
+
+            const uint16_t first_col = tile_col * tile_size;
+            const uint16_t last_col = std::min<uint16_t>(first_col + tile_size, dst.width);
+
+            uint32_t span_sum = 0;
+
+            for (uint16_t col = first_col; col < last_col; ++col) {
+
+                const uint8_t diff = std::abs(src1.at(row, col) - src2.at(row, col));
+
+                dst.at(row, col) = diff;
+                span_sum += diff;
+            }
+
+            row_tile_sums[tile_col] += span_sum;
+            sum += span_sum;
+        }
+    }
+
+    return sum;
+}
+
+uint32_t transform::threshold(Image& dst, const Image& src, const uint8_t thresh_val) noexcept {
+
+    uint32_t count = 0;
 
     for (uint16_t row = 0; row < dst.height; ++row) {
 
         for (uint16_t col = 0; col < dst.width; ++col) {
 
-            dst.at(row, col) = (src.at(row, col) <= thresh_val) ? 0 : 255;
+            const bool is_above = src.at(row, col) > thresh_val;
+
+            dst.at(row, col) = is_above ? 255 : 0;
+            count += is_above;
+        }
+    }
+
+    return count;
+}
+
+uint32_t transform::threshold(Image& dst, const Image& src, const uint8_t* const tile_thresholds, const uint8_t tile_size) noexcept {
+
+    const uint16_t tile_cols = (dst.width + tile_size - 1) / tile_size;
+    uint32_t count = 0;
+
+    for (uint16_t row = 0; row < dst.height; ++row) {
+
+        const uint8_t* const row_tile_thresholds = &tile_thresholds[(row / tile_size) * tile_cols];
+
+        for (uint16_t tile_col = 0; tile_col < tile_cols; ++tile_col) {
+
+            const uint8_t thresh_val = row_tile_thresholds[tile_col];
+            const uint16_t first_col = tile_col * tile_size;
+            const uint16_t last_col = std::min<uint16_t>(first_col + tile_size, dst.width);
+
+            for (uint16_t col = first_col; col < last_col; ++col) {
+
+                const bool is_above = src.at(row, col) > thresh_val;
+
+                dst.at(row, col) = is_above ? 255 : 0;
+                count += is_above;
+            }
+        }
+    }
+
+    return count;
+}
+
+uint32_t transform::intersect_changes(Image& mask, const Image& src1, const Image& src2, const uint8_t thresh_val) noexcept {
+
+    uint32_t count = 0;
+
+    for (uint16_t row = 0; row < mask.height; ++row) {
+
+        for (uint16_t col = 0; col < mask.width; ++col) {
+
+            const bool is_above = std::abs(src1.at(row, col) - src2.at(row, col)) > thresh_val;
+            const uint8_t value = is_above ? mask.at(row, col) : 0;
+
+            mask.at(row, col) = value;
+            count += value != 0;
         }
     }
+
+    return count;
+}
+
+uint32_t transform::intersect_changes(Image& mask, const Image& src1, const Image& src2, const uint8_t* const tile_thresholds, const uint8_t tile_size) noexcept {
+
+    const uint16_t tile_cols = (mask.width + tile_size - 1) / tile_size;
+    uint32_t count = 0;
+
+    for (uint16_t row = 0; row < mask.height; ++row) {
+
+        const uint8_t* const row_tile_thresholds = &tile_thresholds[(row / tile_size) * tile_cols];
+
+        for (uint16_t tile_col = 0; tile_col < tile_cols; ++tile_col) {
+
+            const uint8_t thresh_val = row_tile_thresholds[tile_col];
+            const uint16_t first_col = tile_col * tile_size;
+            const uint16_t last_col = std::min<uint16_t>(first_col + tile_size, mask.width);
+
+            for (uint16_t col = first_col; col < last_col; ++col) {
+
+                const bool is_above = std::abs(src1.at(row, col) - src2.at(row, col)) > thresh_val;
+                const uint8_t value = is_above ? mask.at(row, col) : 0;
+
+                mask.at(row, col) = value;
+                count += value != 0;
+            }
+        }
+    }
+
+    return count;
+}
+
+uint32_t transform::mask_tiles(Image& mask, const uint8_t* const tile_skip_mask, uint16_t* const tile_counts, const uint8_t tile_size) noexcept {
+
+    const uint16_t tile_cols = (mask.width + tile_size - 1) / tile_size;
+    uint32_t count = 0;
+
+    for (uint16_t row = 0; row < mask.height; ++row) {
+
+        const uint32_t first_tile_idx = (row / tile_size) * tile_cols;
+
+        for (uint16_t tile_col = 0; tile_col < tile_cols; ++tile_col) {
+
+            const bool is_skipped = tile_skip_mask && tile_skip_mask[first_tile_idx + tile_col];
+            const uint8_t keep_bits = is_skipped ? 0 : 0xFF;
+            const uint16_t first_col = tile_col * tile_size;
+            const uint16_t last_col = std::min<uint16_t>(first_col + tile_size, mask.width);
+
+            uint16_t span_count = 0;
+
+            for (uint16_t col = first_col; col < last_col; ++col) {
+
+                span_count += mask.at(row, col) != 0;
+                mask.at(row, col) &= keep_bits;
+            }
+
+            if (tile_counts) {
+
+                tile_counts[first_tile_idx + tile_col] += span_count;
+            }
+
+            count += is_skipped ? 0 : span_count;
+        }
+    }
+
+    return count;
 }
 
 void transform::dilate(Image& dst, const Image& src, const uint8_t struct_elem_size) noexcept {
 
-    const Kernel<int> dilate_kernel(
-        1,                     // single (repeating) element
-        struct_elem_size,      // height in px
-        struct_elem_size,      // width in px
-        struct_elem_size / 2,  // anchor X-coordinate
-        struct_elem_size / 2,  // anchor Y-coordinate
-        1,                     // stride in X direction
-        1,                     // stride in Y direction
-        [](int x) noexcept -> uint8_t { return !x ? 0 : 255; }  // dilation-specific postprocessing
-    );
-
-    dilate_kernel.convolve(dst, src);
+    // window of the reflected structuring element (matters for even sizes only)
+    const uint8_t reach_back = struct_elem_size / 2;
+    const uint8_t reach_ahead = struct_elem_size ? struct_elem_size - 1 - reach_back : 0;
+
+    copy(dst, src);
+    running_extremum<std::greater<uint8_t>>(dst, reach_back, reach_ahead);
+}
+
+void transform::erode(Image& dst, const Image& src, const uint8_t struct_elem_size) noexcept {
+
+    const uint8_t reach_ahead = struct_elem_size / 2;
+    const uint8_t reach_back = struct_elem_size ? struct_elem_size - 1 - reach_ahead : 0;
+
+    copy(dst, src);
+    running_extremum<std::less<uint8_t>>(dst, reach_back, reach_ahead);
+}
+
+void transform::open(Image& dst, const Image& src, const uint8_t struct_elem_size) noexcept {
+
+    erode(dst, src, struct_elem_size);
+    dilate(dst, dst, struct_elem_size);
+}
+
+void transform::close(Image& dst, const Image& src, const uint8_t struct_elem_size) noexcept {
+
+    dilate(dst, src, struct_elem_size);
+    erode(dst, dst, struct_elem_size);
 }
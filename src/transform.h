@@ -15,10 +15,29 @@ namespace transform {
 /// \param dst   Image for writing output to.
 /// \param src1  First input image.
 /// \param src2  Second input image.
+/// \return      Sum of all the output pixel values.
 ///
 /// If references to destination and one of the source images alias the same
-/// image, the aliased image will serve both as input and output.
-void absdiff(Image& dst, const Image& src1, const Image& src2) noexcept;
+/// image, the aliased image will serve both as input and output. The returned
+/// sum comes at virtually no extra cost and gives the mean difference between
+/// the images (e.g. for detecting global changes in brightness).
+uint64_t absdiff(Image& dst, const Image& src1, const Image& src2) noexcept;
+
+/// \brief Calculates element-wise absolute difference between two images, summing it up per tile.
+///
+/// \param dst        Image for writing output to.
+/// \param src1       First input image.
+/// \param src2       Second input image.
+/// \param tile_sums  Per-tile sums to add the output pixel values to, one per
+///                   tile of `tile_size` x `tile_size` pixels, row by row
+///                   (`ceil(width / tile_size)` per row of tiles).
+/// \param tile_size  Width (and height) of tiles in pixels.
+/// \return           Sum of all the output pixel values.
+///
+/// Same as the above, with per-tile statistics gathered on the way (e.g. for
+/// estimating the noise level locally). Tiles along the right and bottom edges
+/// may be partial.
+uint64_t absdiff(Image& dst, const Image& src1, const Image& src2, uint32_t* tile_sums, uint8_t tile_size) noexcept;
 
 /// \brief Binarizes image values either to \c 0 or \c UINT8_MAX.
 ///
@@ -26,10 +45,55 @@ void absdiff(Image& dst, const Image& src1, const Image& src2) noexcept;
 /// \param src        Image to binarize according to `threshold`.
 /// \param threshold  Inclusive upper limit on input for setting it to \c 0;
 ///                   exclusive lower limit on input for setting it to \c UINT8_MAX
+/// \return           Count of output pixels set to \c UINT8_MAX.
 ///
 /// If references to destination and source images alias the same image, the
 /// operation will be done in place.
-void threshold(Image& dst, const Image& src, uint8_t threshold) noexcept;
+uint32_t threshold(Image& dst, const Image& src, uint8_t threshold) noexcept;
+
+/// \brief Binarizes image values either to \c 0 or \c UINT8_MAX using a separate threshold for each tile.
+///
+/// \param dst              Image for writing output to.
+/// \param src              Image to binarize.
+/// \param tile_thresholds  Thresholds (see above), one per tile, laid out
+///                         the same way as the tile sums of absdiff().
+/// \param tile_size        Width (and height) of tiles in pixels.
+/// \return                 Count of output pixels set to \c UINT8_MAX.
+///
+/// Each row is processed in spans of a single tile, so the inner loop is as
+/// branch-free as the one with a single threshold. Aliasing rules are the
+/// same as above.
+uint32_t threshold(Image& dst, const Image& src, const uint8_t* tile_thresholds, uint8_t tile_size) noexcept;
+
+/// \brief Keeps only those pixels of a b/w mask at which two images differ.
+///
+/// \param mask       Mask to update in place.
+/// \param src1       First input image.
+/// \param src2       Second input image.
+/// \param threshold  Absolute difference between the input images at or below
+///                   which the mask pixel is set to \c 0.
+/// \return           Count of non-zero mask pixels left.
+///
+/// Equivalent to a bitwise AND of `mask` and the thresholded absolute
+/// difference of the input images, without storing the latter (e.g. for
+/// intersecting differences between more than two frames).
+uint32_t intersect_changes(Image& mask, const Image& src1, const Image& src2, uint8_t threshold) noexcept;
+
+/// \brief Same as above, using a separate threshold for each tile (see threshold()).
+uint32_t intersect_changes(Image& mask, const Image& src1, const Image& src2, const uint8_t* tile_thresholds, uint8_t tile_size) noexcept;
+
+/// \brief Counts non-zero pixels of a b/w mask per tile and clears the tiles skipped.
+///
+/// \param mask            Mask to update in place.
+/// \param tile_skip_mask  Non-zero for tiles to clear, one per tile, laid out
+///                        the same way as the tile sums of absdiff(). Can be
+///                        \c nullptr for counting only.
+/// \param tile_counts     Per-tile counts to add the non-zero pixels to, as
+///                        they were before clearing. Can be \c nullptr for
+///                        clearing only.
+/// \param tile_size       Width (and height) of tiles in pixels.
+/// \return                Count of non-zero mask pixels left.
+uint32_t mask_tiles(Image& mask, const uint8_t* tile_skip_mask, uint16_t* tile_counts, uint8_t tile_size) noexcept;
 
 /// \brief Dilates a b/w image using a flat square-shaped structuring element.
 ///
@@ -37,13 +101,49 @@ void threshold(Image& dst, const Image& src, uint8_t threshold) noexcept;
 /// \param src            Image to dilate.
 /// \param str_elem_size  Width (and height) of the structuring element.
 ///
-/// \attention Source and destination images **must not alias the same exact**
-/// frame buffer. If memory savings are paramount, consult
-/// JpegMotionDetector::detect in JpegMotionDetector.h on how to minimally
-/// offset the frame buffers in order to avoid writing output over still
-/// relevant input.
+/// Computed as a separable running maximum in amortized constant time per
+/// pixel, regardless of `str_elem_size`. Pixels beyond image boundaries are
+/// considered to be \c 0.
+///
+/// \attention Source and destination images may alias the same frame buffer,
+/// in which case the operation is done in place. Otherwise, the destination
+/// frame buffer may overlap the source one only if it starts no later than the
+/// source one (see JpegMotionDetector::detect in JpegMotionDetector.h for how
+/// that is used for saving memory).
 void dilate(Image& dst, const Image& src, uint8_t str_elem_size) noexcept;
 
+/// \brief Erodes a b/w image using a flat square-shaped structuring element.
+///
+/// \param dst            Image for writing output to.
+/// \param src            Image to erode.
+/// \param str_elem_size  Width (and height) of the structuring element.
+///
+/// Computed as a separable running minimum in amortized constant time per
+/// pixel, regardless of `str_elem_size`. Pixels beyond image boundaries do
+/// not erode the image. Aliasing rules are the same as for dilate().
+void erode(Image& dst, const Image& src, uint8_t str_elem_size) noexcept;
+
+/// \brief Morphological opening (erosion followed by dilation) of a b/w image.
+///
+/// \param dst            Image for writing output to.
+/// \param src            Image to open.
+/// \param str_elem_size  Width (and height) of the structuring element.
+///
+/// Removes foreground specks smaller than the structuring element (e.g.
+/// single-pixel sensor noise) while preserving the shape of larger regions.
+/// Aliasing rules are the same as for dilate().
+void open(Image& dst, const Image& src, uint8_t str_elem_size) noexcept;
+
+/// \brief Morphological closing (dilation followed by erosion) of a b/w image.
+///
+/// \param dst            Image for writing output to.
+/// \param src            Image to close.
+/// \param str_elem_size  Width (and height) of the structuring element.
+///
+/// Fills background gaps smaller than the structuring element while preserving
+/// the shape of larger regions. Aliasing rules are the same as for dilate().
+void close(Image& dst, const Image& src, uint8_t str_elem_size) noexcept;
+
 }  // namespace transform
 
 }  // namespace mdetect
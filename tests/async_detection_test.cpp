@@ -0,0 +1,125 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <new>
+
+#include "mdjpeg.h"
+
+#include "AsyncDetection.h"
+#include "JpegMotionDetector.h"
+
+#include "check.h"
+
+
+// builds (under C++20) and exercises the parts of the API which are header-only
+// templates with no other users in the tree, so that they cannot rot unnoticed
+namespace {
+
+using MotionDetector = mdetect::JpegMotionDetector<128, 96>;
+
+// neither a JPEG nor anything like it, decoding it fails
+const uint8_t garbage_frame[] = {0x00, 0x01, 0x02, 0x03};
+
+// resumes coroutines on the thread draining it
+class QueueExecutor {
+
+    public:
+
+        void execute(const std::coroutine_handle<> handle) noexcept {
+
+            m_handles.push_back(handle);
+        }
+
+        void drain() {
+
+            while (!m_handles.empty()) {
+
+                const std::coroutine_handle<> handle = m_handles.front();
+                m_handles.pop_front();
+                handle.resume();
+            }
+        }
+
+    private:
+
+        std::deque<std::coroutine_handle<>> m_handles;
+};
+
+uint allocations_count = 0;
+uint deallocations_count = 0;
+
+template<typename T>
+struct CountingAllocator {
+
+    using value_type = T;
+
+    CountingAllocator() = default;
+
+    template<typename U>
+    CountingAllocator(const CountingAllocator<U>&) noexcept {}
+
+    T* allocate(const size_t count) {
+
+        ++allocations_count;
+
+        return std::allocator<T>().allocate(count);
+    }
+
+    void deallocate(T* const ptr, const size_t count) noexcept {
+
+        ++deallocations_count;
+        std::allocator<T>().deallocate(ptr, count);
+    }
+};
+
+mdetect::DetectionTask detect_with_allocator(std::allocator_arg_t, CountingAllocator<int>, MotionDetector& detector, QueueExecutor& executor, int& result) {
+
+    result = co_await mdetect::detect_async(detector, executor, garbage_frame, sizeof(garbage_frame));
+}
+
+mdetect::DetectionTask detect_plain(MotionDetector& detector, QueueExecutor& executor, int& result) {
+
+    result = co_await mdetect::detect_async(detector, executor, garbage_frame, sizeof(garbage_frame));
+}
+
+void test_async_detection() {
+
+    std::cout << "detect_async/DetectionTask:\n";
+
+    mdjpeg::JpegDecoder decoder;
+    static MotionDetector detector(decoder);
+    QueueExecutor executor;
+
+    int result = 0;
+    detect_with_allocator(std::allocator_arg, CountingAllocator<int>(), detector, executor, result);
+
+    check(allocations_count == 1, "coroutine frame from the allocator");
+    check(result == 0, "suspended until resumed by the executor");
+
+    executor.drain();
+
+    check(result == MotionDetector::DECODE_FAILED, "result of detect() on the executor");
+    check(deallocations_count == 1, "coroutine frame back to the allocator");
+
+    result = 0;
+    detect_plain(detector, executor, result);
+    executor.drain();
+
+    check(result == MotionDetector::DECODE_FAILED, "result of detect() without an allocator");
+    check(allocations_count == 1 && deallocations_count == 1, "default allocation");
+}
+
+}  // namespace
+
+
+int main() {
+
+    test_async_detection();
+
+    return report_checks();
+}
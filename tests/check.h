@@ -0,0 +1,32 @@
+#pragma once
+
+#include <sys/types.h>
+#include <iostream>
+
+
+// minimal checking shared by the API tests, each test program counts its own failures
+inline uint failures_count = 0;
+
+inline void check(const bool condition, const char* const what) {
+
+    if (!condition) {
+
+        std::cout << "   FAILED: " << what << "\n";
+        ++failures_count;
+    }
+}
+
+// reports the outcome, returns the exit code for `main`
+inline int report_checks() {
+
+    if (failures_count) {
+
+        std::cout << failures_count << " check(s) FAILED\n";
+
+        return 1;
+    }
+
+    std::cout << "all checks PASSED\n";
+
+    return 0;
+}
@@ -0,0 +1,203 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <vector>
+
+#include "mdjpeg.h"
+
+#include "DetectionScheduler.h"
+#include "JpegMotionDetector.h"
+
+#include "check.h"
+
+
+namespace {
+
+using MotionDetector = mdetect::JpegMotionDetector<128, 96>;
+
+// neither a JPEG nor anything like it, decoding it fails
+const uint8_t garbage_frame[] = {0x00, 0x01, 0x02, 0x03};
+
+// detector stand-in returning scripted results
+struct ScriptedDetector {
+
+    static constexpr int DECODE_FAILED = MotionDetector::DECODE_FAILED;
+    static constexpr int GLOBAL_CHANGE = MotionDetector::GLOBAL_CHANGE;
+
+    int next_result {};
+    uint calls_count {};
+    bool is_reference_updated {};
+
+    int detect(const uint8_t*, size_t, uint8_t, const bool update_reference) noexcept {
+
+        ++calls_count;
+        is_reference_updated = update_reference;
+
+        return next_result;
+    }
+};
+
+}  // namespace
+
+// all the members, against the real detector
+template class mdetect::DetectionScheduler<MotionDetector, 2>;
+
+namespace {
+
+using Scheduler = mdetect::DetectionScheduler<ScriptedDetector, 2>;
+
+// detects on the frames of stream 0 until detection is due, returns its result
+int detect_when_due(Scheduler& scheduler) {
+
+    int result = Scheduler::SKIPPED;
+
+    while (result == Scheduler::SKIPPED) {
+
+        result = scheduler.detect(0, garbage_frame, sizeof(garbage_frame));
+    }
+
+    return result;
+}
+
+void test_scheduler() {
+
+    std::cout << "DetectionScheduler:\n";
+
+    ScriptedDetector detector;
+    Scheduler scheduler(2);
+
+    check(scheduler.attach(0, detector, 4), "attaching a stream");
+    check(!scheduler.attach(2, detector, 4), "attaching out of range");
+    check(scheduler.detect(1, garbage_frame, sizeof(garbage_frame)) == Scheduler::NOT_ATTACHED, "detecting on a stream not attached");
+
+    // every 2 quiet detections the interval doubles, up to 4 frames
+    detector.next_result = 0;
+    const uint16_t expected_intervals[] = {1, 1, 2, 2, 2, 2, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4};
+    for (const uint16_t expected_interval : expected_intervals) {
+
+        check(scheduler.get_interval(0) == expected_interval, "backing off on quiet detections");
+
+        const int result = scheduler.detect(0, garbage_frame, sizeof(garbage_frame));
+
+        check(result == 0 || result == Scheduler::SKIPPED, "skipping frames between detections");
+    }
+
+    check(detector.calls_count == 2 + 2 + 2, "detections while backing off");
+
+    // a frame failing to decompress is not waited for another interval, the next one is detected on
+    detector.next_result = ScriptedDetector::DECODE_FAILED;
+    check(detect_when_due(scheduler) == ScriptedDetector::DECODE_FAILED, "decompression failure when due");
+
+    detector.next_result = 0;
+    const uint calls_count = detector.calls_count;
+    check(scheduler.detect(0, garbage_frame, sizeof(garbage_frame)) == 0 && detector.calls_count == calls_count + 1,
+          "retrying on the frame after a decompression failure");
+    check(scheduler.detect(0, garbage_frame, sizeof(garbage_frame)) == Scheduler::SKIPPED, "skipping again after the retry");
+    check(scheduler.get_interval(0) == 4, "keeping the interval over decompression failures");
+
+    // the reference is updated only if asked for, and only on frames detected on
+    detector.is_reference_updated = false;
+    while (scheduler.detect(0, garbage_frame, sizeof(garbage_frame), 127, true) == Scheduler::SKIPPED) {
+
+        check(!detector.is_reference_updated, "no detection on frames skipped");
+    }
+    check(detector.is_reference_updated, "updating the reference on request");
+
+    // movements reset the interval on the next detection
+    detector.next_result = 1;
+    detect_when_due(scheduler);
+    check(scheduler.get_interval(0) == 1, "resetting on movements");
+    check(!detector.is_reference_updated, "not updating the reference by default");
+
+    // as do global changes, after backing off once more
+    detector.next_result = 0;
+    scheduler.detect(0, garbage_frame, sizeof(garbage_frame));
+    scheduler.detect(0, garbage_frame, sizeof(garbage_frame));
+    check(scheduler.get_interval(0) == 2, "backing off again");
+
+    detector.next_result = ScriptedDetector::GLOBAL_CHANGE;
+    detect_when_due(scheduler);
+    check(scheduler.get_interval(0) == 1, "resetting on global changes");
+
+    // decompression failures count neither way
+    detector.next_result = ScriptedDetector::DECODE_FAILED;
+    for (uint frame_idx = 0; frame_idx < 8; ++frame_idx) {
+
+        scheduler.detect(0, garbage_frame, sizeof(garbage_frame));
+    }
+    check(scheduler.get_interval(0) == 1, "ignoring decompression failures");
+}
+
+// updating the reference frame while detecting must be equivalent to setting it afterwards
+void test_reference_update(const std::filesystem::path& input_dir) {
+
+    std::cout << "JpegMotionDetector::detect() updating the reference:\n";
+
+    const auto input_paths = mdjpeg::test_utils::get_input_img_paths(input_dir);
+
+    check(input_paths.size() > 2, "input frames found");
+
+    mdjpeg::JpegDecoder decoder;
+    mdjpeg::JpegDecoder updating_decoder;
+    MotionDetector detector(decoder);
+    MotionDetector updating_detector(updating_decoder);
+
+    bool is_reference_set = false;
+
+    for (const auto& input_path : input_paths) {
+
+        std::ifstream file(input_path, std::ios::binary);
+        const std::vector<uint8_t> frame((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        if (!is_reference_set) {
+
+            is_reference_set = detector.set_reference(frame.data(), frame.size()) &&
+                               updating_detector.set_reference(frame.data(), frame.size());
+
+            continue;
+        }
+
+        const int result = detector.detect(frame.data(), frame.size());
+        const int updating_result = updating_detector.detect(frame.data(), frame.size(), 127, true);
+
+        if (result != MotionDetector::DECODE_FAILED) {
+
+            detector.set_reference(frame.data(), frame.size());
+        }
+
+        const auto bboxes = detector.bboxes();
+        const auto updating_bboxes = updating_detector.bboxes();
+
+        check(result == updating_result &&
+              std::equal(bboxes.begin(), bboxes.end(), updating_bboxes.begin(), updating_bboxes.end(),
+                         [](const mdjpeg::BoundingBox& bbox1, const mdjpeg::BoundingBox& bbox2) {
+
+                             return bbox1.topleft_X == bbox2.topleft_X && bbox1.topleft_Y == bbox2.topleft_Y &&
+                                    bbox1.bottomright_X == bbox2.bottomright_X && bbox1.bottomright_Y == bbox2.bottomright_Y;
+                         }),
+              "same results as with set_reference() afterwards");
+    }
+}
+
+}  // namespace
+
+
+int main(int argc, char** argv) {
+
+    if (argc != 2) {
+
+        std::cout << "usage: " << argv[0] << " input_directory\n";
+
+        return 1;
+    }
+
+    test_scheduler();
+    test_reference_update(argv[1]);
+
+    return report_checks();
+}
@@ -0,0 +1,201 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <thread>
+#include <vector>
+
+#include "mdjpeg.h"
+
+#include "JpegMotionDetector.h"
+#include "TripleBuffer.h"
+
+#include "check.h"
+
+
+namespace {
+
+using MotionDetector = mdetect::JpegMotionDetector<128, 96>;
+using Result = mdetect::DetectionResult<5>;
+
+void test_triple_buffer() {
+
+    std::cout << "TripleBuffer:\n";
+
+    static mdetect::TripleBuffer<Result> buffer;
+
+    check(!buffer.update(), "nothing to pick up before publishing");
+    check(buffer.front().frame_id == 0 && buffer.front().bboxes_count == 0, "default snapshot before the first one picked up");
+
+    buffer.back().frame_id = 1;
+    buffer.publish();
+
+    check(buffer.update() && buffer.front().frame_id == 1, "picking up a snapshot");
+    check(!buffer.update() && buffer.front().frame_id == 1, "nothing new to pick up, front unchanged");
+
+    // snapshots published in between are skipped, only the latest one is picked up
+    for (uint32_t frame_id = 2; frame_id <= 4; ++frame_id) {
+
+        buffer.back().frame_id = frame_id;
+        buffer.publish();
+    }
+
+    check(buffer.update() && buffer.front().frame_id == 4, "picking up the latest snapshot");
+    check(!buffer.update(), "picking up the latest snapshot once");
+}
+
+void test_snapshot_publisher() {
+
+    std::cout << "SnapshotPublisher:\n";
+
+    constexpr uint8_t readers_count = 2;
+    constexpr uint32_t snapshots_count = 100000;
+
+    static mdetect::SnapshotPublisher<Result, readers_count> publisher;
+
+    check(!publisher.update(0), "nothing to pick up before publishing");
+
+    // every snapshot is self-consistent, readers must never see a torn one nor go back in time
+    std::atomic<bool> is_done {false};
+    std::atomic<uint> torn_count {0};
+    std::atomic<uint> reordered_count {0};
+
+    auto read = [&](const uint8_t reader_idx) {
+
+        uint32_t last_frame_id = 0;
+
+        while (true) {
+
+            // anything published before `is_done` is set is visible to the update that follows
+            const bool is_last_update = is_done.load(std::memory_order_acquire);
+
+            if (!publisher.update(reader_idx)) {
+
+                if (is_last_update) {
+
+                    break;
+                }
+
+                continue;
+            }
+
+            const Result& result = publisher.read(reader_idx);
+
+            torn_count += result.diff_sum != 3ULL * result.frame_id ||
+                          result.bboxes_count != result.frame_id % 5 ||
+                          result.bboxes[0].topleft_X != static_cast<uint16_t>(result.frame_id);
+            reordered_count += result.frame_id < last_frame_id;
+            last_frame_id = result.frame_id;
+        }
+    };
+
+    std::thread readers[readers_count];
+    for (uint8_t reader_idx = 0; reader_idx < readers_count; ++reader_idx) {
+
+        readers[reader_idx] = std::thread(read, reader_idx);
+    }
+
+    Result result;
+    for (uint32_t frame_id = 1; frame_id <= snapshots_count; ++frame_id) {
+
+        result.frame_id = frame_id;
+        result.diff_sum = 3ULL * frame_id;
+        result.bboxes_count = frame_id % 5;
+        result.bboxes[0].topleft_X = frame_id;
+
+        publisher.publish(result);
+    }
+
+    is_done.store(true, std::memory_order_release);
+
+    for (auto& reader : readers) {
+
+        reader.join();
+    }
+
+    check(!torn_count, "no torn snapshots");
+    check(!reordered_count, "no snapshots older than ones already read");
+
+    for (uint8_t reader_idx = 0; reader_idx < readers_count; ++reader_idx) {
+
+        check(publisher.read(reader_idx).frame_id == snapshots_count, "the latest snapshot picked up last");
+    }
+}
+
+// snapshots must hold what the detector reports through its own accessors
+void test_get_result(const std::filesystem::path& input_dir) {
+
+    std::cout << "JpegMotionDetector::get_result():\n";
+
+    const auto input_paths = mdjpeg::test_utils::get_input_img_paths(input_dir);
+
+    check(input_paths.size() > 1, "input frames found");
+
+    mdjpeg::JpegDecoder decoder;
+    MotionDetector detector(decoder);
+
+    uint32_t frame_id = 0;
+
+    for (const auto& input_path : input_paths) {
+
+        std::ifstream file(input_path, std::ios::binary);
+        const std::vector<uint8_t> frame((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        ++frame_id;
+
+        if (frame_id == 1) {
+
+            detector.set_reference(frame.data(), frame.size());
+
+            continue;
+        }
+
+        const int result = detector.detect(frame.data(), frame.size());
+
+        if (result == MotionDetector::DECODE_FAILED) {
+
+            continue;
+        }
+
+        Result snapshot;
+        detector.get_result(frame_id, snapshot);
+
+        const auto bboxes = detector.bboxes();
+        bool is_same = snapshot.frame_id == frame_id && snapshot.bboxes_count == bboxes.size() &&
+                       snapshot.status == detector.get_status();
+        uint8_t bbox_idx = 0;
+
+        for (const auto& bbox : bboxes) {
+
+            const auto& snapshot_bbox = snapshot.bboxes[bbox_idx++];
+
+            is_same = is_same && bbox.topleft_X == snapshot_bbox.topleft_X && bbox.topleft_Y == snapshot_bbox.topleft_Y &&
+                      bbox.bottomright_X == snapshot_bbox.bottomright_X && bbox.bottomright_Y == snapshot_bbox.bottomright_Y;
+        }
+
+        check(is_same, "same outcome as reported by the detector");
+    }
+}
+
+}  // namespace
+
+
+int main(int argc, char** argv) {
+
+    if (argc != 2) {
+
+        std::cout << "usage: " << argv[0] << " input_directory\n";
+
+        return 1;
+    }
+
+    test_triple_buffer();
+    test_snapshot_publisher();
+    test_get_result(argv[1]);
+
+    return report_checks();
+}
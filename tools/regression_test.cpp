@@ -0,0 +1,511 @@
+#include <stdint.h>
+#include <sys/types.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <filesystem>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "mdjpeg.h"
+
+#include "JpegMotionDetector.h"
+#include "MjpegStream.h"
+
+
+// The references are recorded from the baseline tree (see `test-record` in the
+// Makefile), which this file is then built against with `REGRESSION_BASELINE`
+// defined: recording only, through the part of the detector API the baseline
+// already had. The detector is used with its default settings, which
+// reproduce the baseline results.
+
+namespace {
+
+// same setup as in `example_tests.cpp`, apart from the detector left with its default settings
+constexpr uint16_t width = 1024;
+constexpr uint16_t height = 768;
+constexpr uint16_t downscaled_width = width / 8;
+constexpr uint16_t downscaled_height = height / 8;
+constexpr uint16_t dest_width = 64;
+constexpr uint16_t dest_height = 64;
+constexpr uint8_t detection_threshold = 127;
+constexpr uint min_bbox_size = 16;
+constexpr uint max_bbox_size = downscaled_height / 2;
+
+using MotionDetector = mdetect::JpegMotionDetector<downscaled_width, downscaled_height>;
+
+#ifndef REGRESSION_BASELINE
+// streaming detection is checked at full resolution, where both paths see the very same decoded pixels
+// (downscaled ones are averaged differently, see `JpegMotionDetector::detect_streaming`)
+using FullResMotionDetector = mdetect::JpegMotionDetector<width, height>;
+
+// enough for 4:2:0 subsampled images without downscaling
+constexpr uint8_t streaming_band_rows = 17;
+#endif
+
+// whole sequence runs timed, the fastest one counts
+constexpr uint timing_runs_count = 5;
+
+const char* const boxes_filename = "boxes.txt";
+const char* const timing_filename = "timing.txt";
+
+struct InputFrame {
+
+    std::string name;
+    mdetect::JpegFrame frame;
+};
+
+struct FrameResult {
+
+    std::string name;
+    int movements_count {};
+    std::vector<mdjpeg::BoundingBox> bboxes;
+    std::vector<std::vector<uint8_t>> crops;
+};
+
+// reads all the input files into memory and splits them into frames, named as in `example_tests.cpp`
+bool load_frames(const std::filesystem::path& input_dir, std::vector<std::vector<uint8_t>>& files, std::vector<InputFrame>& frames) {
+
+    const auto input_paths = mdjpeg::test_utils::get_input_img_paths(input_dir);
+
+    for (const auto& input_path : input_paths) {
+
+        std::ifstream file(input_path, std::ios::binary);
+
+        if (!file) {
+
+            std::cerr << "cannot read input file: " << input_path << "\n";
+
+            return false;
+        }
+
+        files.emplace_back(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    for (size_t file_idx = 0; file_idx < files.size(); ++file_idx) {
+
+        const uint8_t* begin = files[file_idx].data();
+        const uint8_t* const end = begin + files[file_idx].size();
+        uint frame_idx = 0;
+
+        for (mdetect::JpegFrame frame; begin = mdetect::mjpeg::find_frame(begin, end, frame), frame; ++frame_idx) {
+
+            std::string name = input_paths[file_idx].stem();
+            if (frame_idx) {
+
+                name += "-" + std::to_string(frame_idx);
+            }
+
+            frames.push_back({name, frame});
+        }
+    }
+
+    return !frames.empty();
+}
+
+// runs the whole pipeline of `example_tests.cpp` over the frames, collecting the results unless `results` is `nullptr`
+void run_sequence(const std::vector<InputFrame>& frames, std::vector<FrameResult>* const results) {
+
+    uint8_t dest_buff[dest_width * dest_height];
+    mdjpeg::DownscalingBlockWriter<dest_width, dest_height> downscaling_block_writer;
+    mdjpeg::JpegDecoder jpeg_decoder;
+
+    // a fresh detector for every run, so that runs do not depend on each other
+    MotionDetector motion_detector(jpeg_decoder);
+
+    const mdjpeg::BoundingBox frame_boundaries(0, 0, downscaled_width, downscaled_height);
+    bool is_reference_set = false;
+
+    for (const auto& input_frame : frames) {
+
+        const auto& frame = input_frame.frame;
+
+        if (!is_reference_set) {
+
+            is_reference_set = motion_detector.set_reference(frame.data, frame.size);
+
+            continue;
+        }
+
+        const int movements_count = motion_detector.detect(frame.data, frame.size, detection_threshold);
+
+        FrameResult* const result = results ? &results->emplace_back() : nullptr;
+
+        if (result) {
+
+            result->name = input_frame.name;
+            result->movements_count = movements_count;
+        }
+
+        // decompression failed (global changes are not checked for by default)
+        if (movements_count < 0) {
+
+            continue;
+        }
+
+        while (auto bbox = motion_detector.get_bounding_box()) {
+
+            if (result) {
+
+                result->bboxes.push_back(bbox);
+            }
+
+            bbox.expand_to_square(frame_boundaries);
+
+            if (bbox.width() < min_bbox_size || bbox.width() > max_bbox_size) {
+
+                continue;
+            }
+
+            jpeg_decoder.luma_decode(dest_buff, bbox, downscaling_block_writer);
+
+            if (result) {
+
+                result->crops.emplace_back(dest_buff, dest_buff + sizeof(dest_buff));
+            }
+        }
+
+        motion_detector.set_reference(frame.data, frame.size);
+    }
+}
+
+// mean time per frame in microseconds, of the fastest run
+double time_sequence(const std::vector<InputFrame>& frames) {
+
+    double best_us = 0;
+
+    for (uint run = 0; run < timing_runs_count; ++run) {
+
+        const auto start = std::chrono::steady_clock::now();
+        run_sequence(frames, nullptr);
+        const auto stop = std::chrono::steady_clock::now();
+
+        const double run_us = std::chrono::duration<double, std::micro>(stop - start).count();
+        best_us = run ? std::min(best_us, run_us) : run_us;
+    }
+
+    return best_us / frames.size();
+}
+
+std::string format_boxes_line(const FrameResult& result) {
+
+    std::ostringstream line;
+    line << result.name << " " << result.movements_count;
+
+    for (const auto& bbox : result.bboxes) {
+
+        line << " " << bbox.topleft_X << "," << bbox.topleft_Y << "," << bbox.bottomright_X << "," << bbox.bottomright_Y;
+    }
+
+    return line.str();
+}
+
+std::string crop_filename(const FrameResult& result, const size_t crop_idx) {
+
+    return result.name + "_" + std::to_string(crop_idx) + ".pgm";
+}
+
+// writes box lists and crops (as PGM files) into `output_dir`
+void write_results(const std::vector<FrameResult>& results, const std::filesystem::path& output_dir) {
+
+    std::filesystem::create_directories(output_dir);
+
+    std::ofstream boxes_file(output_dir / boxes_filename);
+
+    for (const auto& result : results) {
+
+        boxes_file << format_boxes_line(result) << "\n";
+
+        for (size_t crop_idx = 0; crop_idx < result.crops.size(); ++crop_idx) {
+
+            mdjpeg::test_utils::write_as_pgm(output_dir / crop_filename(result, crop_idx), result.crops[crop_idx].data(), dest_width, dest_height);
+        }
+    }
+}
+
+#ifndef REGRESSION_BASELINE
+// runs `detect` and `detect_streaming` side by side, reports the frames whose results differ
+bool verify_streaming(const std::vector<InputFrame>& frames) {
+
+    mdjpeg::JpegDecoder decoder;
+    mdjpeg::JpegDecoder streaming_decoder;
+
+    // frame buffers are too large for the stack
+    static FullResMotionDetector motion_detector(decoder);
+    static FullResMotionDetector streaming_motion_detector(streaming_decoder);
+
+    bool is_reference_set = false;
+    bool is_passed = true;
+
+    for (const auto& input_frame : frames) {
+
+        const auto& frame = input_frame.frame;
+
+        if (!is_reference_set) {
+
+            is_reference_set = motion_detector.set_reference(frame.data, frame.size) &&
+                               streaming_motion_detector.set_reference(frame.data, frame.size);
+
+            continue;
+        }
+
+        // the reference is replaced by the current frame either way, in place while streaming
+        const int movements_count = motion_detector.detect(frame.data, frame.size, detection_threshold);
+        const int streaming_movements_count = streaming_motion_detector.detect_streaming<streaming_band_rows>(frame.data,
+                                                                                                            frame.size,
+                                                                                                            detection_threshold,
+                                                                                                            true);
+        motion_detector.set_reference(frame.data, frame.size);
+
+        FrameResult result {input_frame.name, movements_count, {}, {}};
+        FrameResult streaming_result {input_frame.name, streaming_movements_count, {}, {}};
+
+        result.bboxes.assign(motion_detector.bboxes().begin(), motion_detector.bboxes().end());
+        streaming_result.bboxes.assign(streaming_motion_detector.bboxes().begin(), streaming_motion_detector.bboxes().end());
+
+        const std::string line = format_boxes_line(result);
+        const std::string streaming_line = format_boxes_line(streaming_result);
+
+        if (line != streaming_line) {
+
+            std::cout << "   results differ:\n"
+                      << "      detect():           " << line << "\n"
+                      << "      detect_streaming(): " << streaming_line << "\n";
+
+            is_passed = false;
+        }
+    }
+
+    return is_passed;
+}
+
+bool read_file(const std::filesystem::path& path, std::string& contents) {
+
+    std::ifstream file(path, std::ios::binary);
+
+    if (!file) {
+
+        return false;
+    }
+
+    contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+    return true;
+}
+
+std::set<std::string> list_pgm_files(const std::filesystem::path& dir) {
+
+    std::set<std::string> filenames;
+
+    for (const auto& entry : std::filesystem::directory_iterator(dir)) {
+
+        if (entry.is_regular_file() && entry.path().extension() == ".pgm") {
+
+            filenames.insert(entry.path().filename());
+        }
+    }
+
+    return filenames;
+}
+
+// compares box lists line by line and crops bit-exactly, reports all the differences
+bool verify_results(const std::filesystem::path& ref_dir, const std::filesystem::path& output_dir) {
+
+    std::string ref_boxes;
+    std::string output_boxes;
+
+    if (!read_file(ref_dir / boxes_filename, ref_boxes) || !read_file(output_dir / boxes_filename, output_boxes)) {
+
+        std::cerr << "missing " << boxes_filename << " in " << ref_dir << " or " << output_dir << "\n"
+                  << "(references are recorded from the baseline tree by `make test-record` and versioned,\n"
+                  << " except for " << timing_filename << ")\n";
+
+        return false;
+    }
+
+    bool is_passed = true;
+
+    std::istringstream ref_lines(ref_boxes);
+    std::istringstream output_lines(output_boxes);
+    std::string ref_line;
+    std::string output_line;
+
+    for (uint line_idx = 1; ; ++line_idx) {
+
+        const bool has_ref_line = static_cast<bool>(std::getline(ref_lines, ref_line));
+        const bool has_output_line = static_cast<bool>(std::getline(output_lines, output_line));
+
+        if (!has_ref_line && !has_output_line) {
+
+            break;
+        }
+
+        if (!has_ref_line || !has_output_line || ref_line != output_line) {
+
+            std::cout << "   boxes differ at line " << line_idx << ":\n"
+                      << "      expected: " << (has_ref_line ? ref_line : "<none>") << "\n"
+                      << "      actual:   " << (has_output_line ? output_line : "<none>") << "\n";
+
+            is_passed = false;
+        }
+    }
+
+    const auto ref_crops = list_pgm_files(ref_dir);
+    const auto output_crops = list_pgm_files(output_dir);
+
+    for (const auto& filename : ref_crops) {
+
+        if (!output_crops.count(filename)) {
+
+            std::cout << "   missing crop: " << filename << "\n";
+            is_passed = false;
+
+            continue;
+        }
+
+        std::string ref_crop;
+        std::string output_crop;
+
+        if (!read_file(ref_dir / filename, ref_crop) || !read_file(output_dir / filename, output_crop) || ref_crop != output_crop) {
+
+            std::cout << "   crop differs: " << filename << "\n";
+            is_passed = false;
+        }
+    }
+
+    for (const auto& filename : output_crops) {
+
+        if (!ref_crops.count(filename)) {
+
+            std::cout << "   unexpected crop: " << filename << "\n";
+            is_passed = false;
+        }
+    }
+
+    return is_passed;
+}
+
+// checks the time per frame against the baseline in `timing_path`, allowing for `tolerance_percent` slowdown
+bool verify_timing(const std::filesystem::path& timing_path, const double us_per_frame, const double tolerance_percent) {
+
+    std::ifstream timing_file(timing_path);
+    double baseline_us_per_frame = 0;
+
+    if (!(timing_file >> baseline_us_per_frame) || baseline_us_per_frame <= 0) {
+
+        std::cerr << "invalid " << timing_path << "\n";
+
+        return false;
+    }
+
+    const double change_percent = 100 * (us_per_frame - baseline_us_per_frame) / baseline_us_per_frame;
+
+    std::cout << "   time per frame: " << us_per_frame << " us (baseline " << baseline_us_per_frame << " us, "
+              << (change_percent >= 0 ? "+" : "") << change_percent << " %, tolerance +" << tolerance_percent << " %)\n";
+
+    return change_percent <= tolerance_percent;
+}
+
+#endif
+
+}  // namespace
+
+
+int main(int argc, char** argv) {
+
+    const std::string mode = (argc > 1) ? argv[1] : "";
+
+#ifdef REGRESSION_BASELINE
+    if (!(mode == "record" && argc == 4)) {
+
+        std::cout << "usage: " << argv[0] << " record input_directory ref_directory\n"
+                  << "  records reference box lists, crops and time per frame for the input sequence,\n"
+                  << "  as produced by the baseline tree\n";
+
+        return 1;
+    }
+#else
+    if (!((mode == "record" && argc == 4) || (mode == "verify" && (argc == 5 || argc == 6)))) {
+
+        std::cout << "usage: " << argv[0] << " record input_directory ref_directory\n"
+                  << "       " << argv[0] << " verify input_directory ref_directory output_directory [tolerance_percent]\n"
+                  << "  records reference box lists, crops and time per frame for the input sequence,\n"
+                  << "  or verifies that they are reproduced (bit-exactly, and no slower than the\n"
+                  << "  recorded time plus tolerance_percent, 10 by default); verifying also checks\n"
+                  << "  that streaming detection reproduces the results of regular detection\n";
+
+        return 1;
+    }
+#endif
+
+    const std::filesystem::path input_dir = argv[2];
+    const std::filesystem::path ref_dir = argv[3];
+
+    std::vector<std::vector<uint8_t>> files;
+    std::vector<InputFrame> frames;
+
+    if (!std::filesystem::is_directory(input_dir) || !load_frames(input_dir, files, frames)) {
+
+        std::cerr << "no input frames in: " << input_dir << "\n";
+
+        return 1;
+    }
+
+    std::vector<FrameResult> results;
+    run_sequence(frames, &results);
+
+    const double us_per_frame = time_sequence(frames);
+
+    if (mode == "record") {
+
+        write_results(results, ref_dir);
+
+        std::ofstream(ref_dir / timing_filename) << us_per_frame << "\n";
+
+        std::cout << "recorded " << results.size() << " frames into " << ref_dir << " (" << us_per_frame << " us per frame)\n";
+
+        return 0;
+    }
+
+#ifndef REGRESSION_BASELINE
+    const std::filesystem::path output_dir = argv[4];
+    const double tolerance_percent = (argc == 6) ? std::strtod(argv[5], nullptr) : 10;
+
+    // output is kept for inspection, stale crops would be reported as unexpected
+    std::filesystem::remove_all(output_dir);
+    write_results(results, output_dir);
+
+    std::cout << "golden output:\n";
+    const bool is_output_passed = verify_results(ref_dir, output_dir);
+    std::cout << (is_output_passed ? "   PASSED\n" : "   FAILED\n");
+
+    std::cout << "streaming detection:\n";
+    const bool is_streaming_passed = verify_streaming(frames);
+    std::cout << (is_streaming_passed ? "   PASSED\n" : "   FAILED\n");
+
+    // the timing baseline is machine-specific and not versioned, the check is skipped (rather than
+    // passed against whatever this run measures) until it is recorded on the machine
+    std::cout << "performance:\n";
+    const std::filesystem::path timing_path = ref_dir / timing_filename;
+    bool is_timing_passed = true;
+
+    if (std::filesystem::exists(timing_path)) {
+
+        is_timing_passed = verify_timing(timing_path, us_per_frame, tolerance_percent);
+        std::cout << (is_timing_passed ? "   PASSED\n" : "   FAILED\n");
+    }
+
+    else {
+
+        std::cout << "   time per frame: " << us_per_frame << " us\n"
+                  << "   SKIPPED (no baseline in " << timing_path << " on this machine, recorded by `make test-record`)\n";
+    }
+
+    return (is_output_passed && is_streaming_passed && is_timing_passed) ? 0 : 1;
+#endif
+}
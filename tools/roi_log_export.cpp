@@ -0,0 +1,98 @@
+#include <stdint.h>
+#include <sys/types.h>
+#include <cstdlib>
+#include <iostream>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "mdjpeg.h"
+
+#include "RoiLog.h"
+
+
+int main(int argc, char** argv) {
+
+    if (argc != 2 && argc != 4) {
+
+        std::cout << "usage: " << argv[0] << " log_directory [timestamp output_directory]\n"
+                  << "  lists all the records in the log, or exports crops of the frame\n"
+                  << "  with the given timestamp as PGM files into output_directory\n";
+
+        return 1;
+    }
+
+    mdetect::RoiLogReader reader;
+
+    if (!reader.open(argv[1])) {
+
+        std::cerr << "invalid log directory: " << argv[1] << "\n";
+
+        return 1;
+    }
+
+    mdetect::roi_log::RecordHeader header;
+
+    if (argc == 2) {
+
+        std::cout << "timestamp frame_id topleft_X topleft_Y bottomright_X bottomright_Y crop_width crop_height\n";
+
+        for (size_t entry_idx = 0; entry_idx < reader.entries().size(); ++entry_idx) {
+
+            if (!reader.read_header(entry_idx, header)) {
+
+                std::cerr << "corrupted record at timestamp " << reader.entries()[entry_idx].timestamp << "\n";
+
+                continue;
+            }
+
+            std::cout << header.timestamp << " "
+                      << header.frame_id << " "
+                      << header.bbox_topleft_X << " "
+                      << header.bbox_topleft_Y << " "
+                      << header.bbox_bottomright_X << " "
+                      << header.bbox_bottomright_Y << " "
+                      << header.crop_width << " "
+                      << header.crop_height << "\n";
+        }
+
+        return 0;
+    }
+
+    const uint64_t timestamp = std::strtoull(argv[2], nullptr, 10);
+    const auto [first, last] = reader.find(timestamp);
+
+    if (first == last) {
+
+        std::cerr << "no records with timestamp " << timestamp << "\n";
+
+        return 1;
+    }
+
+    const std::filesystem::path output_dir = argv[3];
+    std::filesystem::create_directories(output_dir);
+
+    std::vector<uint8_t> crop_buff;
+
+    for (size_t entry_idx = first; entry_idx < last; ++entry_idx) {
+
+        if (reader.read_header(entry_idx, header)) {
+
+            crop_buff.resize(header.crop_width * header.crop_height);
+        }
+
+        if (!reader.read(entry_idx, header, crop_buff.data(), crop_buff.size())) {
+
+            std::cerr << "corrupted record at timestamp " << timestamp << "\n";
+
+            return 1;
+        }
+
+        const std::filesystem::path output_path = output_dir / (std::to_string(timestamp) + "_" + std::to_string(entry_idx - first) + ".pgm");
+        mdjpeg::test_utils::write_as_pgm(output_path, crop_buff.data(), header.crop_width, header.crop_height);
+
+        std::cout << "exported: " << output_path << "\n";
+    }
+
+    return 0;
+}